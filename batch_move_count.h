@@ -0,0 +1,257 @@
+// batched move counting kernel (see USE_BATCHED_MOVE_COUNT in move_gen.cpp)
+// included once for every vector width, in a namespace and under the matching target pragma: vectors are passed
+// to (and returned from) the helpers by value, and their calling convention changes when AVX is not enabled
+
+template <typename V>
+BATCH_INLINE V splatV(uint64 x)
+{
+    V v = {};
+    return v + x;
+}
+
+// left shift for positive s, right shift for negative
+template <typename V, int s, uint64 mask>
+BATCH_INLINE V shiftV(V x)
+{
+    return ((s > 0) ? (x << (s > 0 ? s : 0)) : (x >> (s < 0 ? -s : 0))) & mask;
+}
+
+// kogge-stone occluded fill followed by one step shift (i.e, attacks of all sliders in gen)
+template <typename V, int s, uint64 mask>
+BATCH_INLINE V slideV(V gen, V pro)
+{
+    pro &= mask;
+    gen |= pro & shiftV<V, s, ALLSET>(gen);
+    pro &= shiftV<V, s, ALLSET>(pro);
+    gen |= pro & shiftV<V, 2 * s, ALLSET>(gen);
+    pro &= shiftV<V, 2 * s, ALLSET>(pro);
+    gen |= pro & shiftV<V, 4 * s, ALLSET>(gen);
+
+    return shiftV<V, s, mask>(gen);
+}
+
+// my piece that is pinned to my king from the given direction (if any)
+template <typename V, int s, uint64 mask>
+BATCH_INLINE V pinnedV(V myKing, V empty, V myPieces, V enemySliders)
+{
+    V blocker = slideV<V, s, mask>(myKing, empty) & myPieces;
+    V pinner  = slideV<V, s, mask>(blocker, empty) & enemySliders;
+    return blocker & (V) (pinner != 0);
+}
+
+template <typename V>
+BATCH_INLINE V kingAttacksV(V kings)
+{
+    return shiftV<V, DIR_NORTH>(kings) | shiftV<V, DIR_SOUTH>(kings) | shiftV<V, DIR_EAST>(kings) | shiftV<V, DIR_WEST>(kings) |
+           shiftV<V, DIR_NORTH_EAST>(kings) | shiftV<V, DIR_NORTH_WEST>(kings) | shiftV<V, DIR_SOUTH_EAST>(kings) | shiftV<V, DIR_SOUTH_WEST>(kings);
+}
+
+template <typename V>
+BATCH_INLINE V knightAttacksV(V knights)
+{
+    return shiftV<V, 17, ~FILEA>(knights) | shiftV<V, 15, ~FILEH>(knights) |
+           shiftV<V, 10, ~(FILEA | FILEB)>(knights) | shiftV<V, 6, ~(FILEG | FILEH)>(knights) |
+           shiftV<V, -17, ~FILEH>(knights) | shiftV<V, -15, ~FILEA>(knights) |
+           shiftV<V, -10, ~(FILEG | FILEH)>(knights) | shiftV<V, -6, ~(FILEA | FILEB)>(knights);
+}
+
+// bit-sliced (carry save) counter of bits of several bitboards
+// no square can be the destination of more than 31 moves, so 5 bit planes are enough
+template <typename V>
+struct BitCounterV
+{
+    V ones, twos, fours, eights, sixteens;
+
+    inline __attribute__((always_inline)) void addFrom(V *plane, V x)
+    {
+        for (V *p = plane; p <= &sixteens; p++)
+        {
+            V carry = *p & x;
+            *p ^= x;
+            x = carry;
+        }
+    }
+};
+
+template <typename V>
+BATCH_INLINE void countBits(BitCounterV<V> &c, V x)     { c.addFrom(&c.ones, x); }
+
+template <typename V>
+BATCH_INLINE void countBitsTwice(BitCounterV<V> &c, V x) { c.addFrom(&c.twos, x); }
+
+template <typename V>
+BATCH_INLINE void countPieceMoves(BitCounterV<V> &c, V moves, V promotionRanks)
+{
+    // a promotion is 4 moves
+    V promotions = moves & promotionRanks;
+    countBits(c, moves);
+    countBits(c, promotions);
+    countBitsTwice(c, promotions);
+}
+
+// counts moves of N positions starting at given index
+// returns mask of positions where the king is in check (those are counted by the regular move counter)
+template <typename V, int N, uint8 chance>
+BATCH_INLINE uint32 countMovesBatchKernel(const HexaBitBoardBatch *batch, int base, uint32 *counts)
+{
+    V whitePieces, pawns, knights, bishopQueens, rookQueens, kings;
+    memcpy(&whitePieces,  &batch->whitePieces[base],  sizeof(V));
+    memcpy(&pawns,        &batch->pawns[base],        sizeof(V));
+    memcpy(&knights,      &batch->knights[base],      sizeof(V));
+    memcpy(&bishopQueens, &batch->bishopQueens[base], sizeof(V));
+    memcpy(&rookQueens,   &batch->rookQueens[base],   sizeof(V));
+    memcpy(&kings,        &batch->kings[base],        sizeof(V));
+
+    V allPawns    = pawns & RANKS2TO7;    // get rid of game state variables
+    V allPieces   = kings | allPawns | knights | bishopQueens | rookQueens;
+    V blackPieces = allPieces & ~whitePieces;
+    V empty       = ~allPieces;
+
+    V myPieces    = (chance == WHITE) ? whitePieces : blackPieces;
+    V enemyPieces = (chance == WHITE) ? blackPieces : whitePieces;
+
+    V myKing       = kings & myPieces;
+    V enemyBishops = bishopQueens & enemyPieces;
+    V enemyRooks   = rookQueens & enemyPieces;
+    V enemyPawns   = allPawns & enemyPieces;
+
+    // squares attacked by enemy pieces (my king doesn't block the sliders)
+    V pro = empty | myKing;
+    V threatened = slideV<V, DIR_NORTH>(enemyRooks, pro) | slideV<V, DIR_SOUTH>(enemyRooks, pro) |
+                   slideV<V, DIR_EAST> (enemyRooks, pro) | slideV<V, DIR_WEST> (enemyRooks, pro) |
+                   slideV<V, DIR_NORTH_EAST>(enemyBishops, pro) | slideV<V, DIR_NORTH_WEST>(enemyBishops, pro) |
+                   slideV<V, DIR_SOUTH_EAST>(enemyBishops, pro) | slideV<V, DIR_SOUTH_WEST>(enemyBishops, pro) |
+                   knightAttacksV(knights & enemyPieces) | kingAttacksV(kings & enemyPieces);
+
+    if (chance == WHITE)
+        threatened |= shiftV<V, DIR_SOUTH_EAST>(enemyPawns) | shiftV<V, DIR_SOUTH_WEST>(enemyPawns);
+    else
+        threatened |= shiftV<V, DIR_NORTH_EAST>(enemyPawns) | shiftV<V, DIR_NORTH_WEST>(enemyPawns);
+
+    V inCheck = (V) ((threatened & myKing) != 0);
+
+    // pinned pieces, grouped by the line they are pinned along (they can move only along that line)
+    V pinnedVertical   = pinnedV<V, DIR_NORTH>(myKing, empty, myPieces, enemyRooks) |
+                         pinnedV<V, DIR_SOUTH>(myKing, empty, myPieces, enemyRooks);
+    V pinnedHorizontal = pinnedV<V, DIR_EAST> (myKing, empty, myPieces, enemyRooks) |
+                         pinnedV<V, DIR_WEST> (myKing, empty, myPieces, enemyRooks);
+    V pinnedDiagonal   = pinnedV<V, DIR_NORTH_EAST>(myKing, empty, myPieces, enemyBishops) |
+                         pinnedV<V, DIR_SOUTH_WEST>(myKing, empty, myPieces, enemyBishops);
+    V pinnedAntiDiag   = pinnedV<V, DIR_NORTH_WEST>(myKing, empty, myPieces, enemyBishops) |
+                         pinnedV<V, DIR_SOUTH_EAST>(myKing, empty, myPieces, enemyBishops);
+    V notPinned = ~(pinnedVertical | pinnedHorizontal | pinnedDiagonal | pinnedAntiDiag);
+
+    BitCounterV<V> c = {};
+    V extraMoves = {};     // moves counted as 0/-1 per lane (castling, en-passent)
+    V promotionRanks = splatV<V>(RANK1 | RANK8);
+
+    // 1. pawn moves
+    V myPawns = allPawns & myPieces;
+    V pushers = myPawns & (notPinned | pinnedVertical);
+    V diagonalCapturers = myPawns & (notPinned | pinnedDiagonal);
+    V antiDiagCapturers = myPawns & (notPinned | pinnedAntiDiag);
+
+    if (chance == WHITE)
+    {
+        V dsts = shiftV<V, DIR_NORTH>(pushers) & empty;
+        countPieceMoves(c, dsts, promotionRanks);
+        countBits(c, shiftV<V, DIR_NORTH>(dsts & RANK3) & empty);
+
+        countPieceMoves(c, shiftV<V, DIR_NORTH_EAST>(diagonalCapturers) & enemyPieces, promotionRanks);
+        countPieceMoves(c, shiftV<V, DIR_NORTH_WEST>(antiDiagCapturers) & enemyPieces, promotionRanks);
+    }
+    else
+    {
+        V dsts = shiftV<V, DIR_SOUTH>(pushers) & empty;
+        countPieceMoves(c, dsts, promotionRanks);
+        countBits(c, shiftV<V, DIR_SOUTH>(dsts & RANK6) & empty);
+
+        countPieceMoves(c, shiftV<V, DIR_SOUTH_WEST>(diagonalCapturers) & enemyPieces, promotionRanks);
+        countPieceMoves(c, shiftV<V, DIR_SOUTH_EAST>(antiDiagCapturers) & enemyPieces, promotionRanks);
+    }
+
+    // en-passent (the file + 1 of the target square is stored in bits 4-7 of pawns)
+    V enPassent = (pawns >> 4) & 0xF;
+    bool anyEnPassent = false;
+    for (int i = 0; i < N; i++)
+        anyEnPassent |= !!enPassent[i];
+
+    if (anyEnPassent)
+    {
+        V target = shiftV<V, (chance == WHITE) ? 40 : 16, ALLSET>(splatV<V>(1) << ((enPassent - 1) & 63)) & (V) (enPassent != 0);
+        V capturedPawn = (chance == WHITE) ? shiftV<V, DIR_SOUTH>(target) : shiftV<V, DIR_NORTH>(target);
+
+        // capturing towards the east is along the diagonal for white, anti-diagonal for black (and vice-versa)
+        V eastCapturer = shiftV<V, DIR_WEST>(capturedPawn) & myPawns;
+        V westCapturer = shiftV<V, DIR_EAST>(capturedPawn) & myPawns;
+        V pinnedEastOk = (chance == WHITE) ? pinnedDiagonal : pinnedAntiDiag;
+        V pinnedWestOk = (chance == WHITE) ? pinnedAntiDiag : pinnedDiagonal;
+
+        for (int side = 0; side < 2; side++)
+        {
+            V capturer = side ? westCapturer : eastCapturer;
+            V ok = capturer & (side ? pinnedWestOk : pinnedEastOk);
+
+            // removing both the pawns from the rank must not expose the king to an enemy rook/queen
+            V notPinnedCapturer = capturer & notPinned;
+            V propogator = empty | capturedPawn | notPinnedCapturer;
+            V exposed = (slideV<V, DIR_EAST>(enemyRooks, propogator) | slideV<V, DIR_WEST>(enemyRooks, propogator)) & myKing;
+            ok |= notPinnedCapturer & (V) (exposed == 0);
+
+            extraMoves += (V) (ok != 0);
+        }
+    }
+
+    // 2. castling
+    if (chance == WHITE)
+    {
+        extraMoves += (V) ((pawns & CASTLE_FLAG_KING_SIDE) != 0) & (V) (((allPieces | threatened) & F1G1) == 0);
+        extraMoves += (V) ((pawns & CASTLE_FLAG_QUEEN_SIDE) != 0) & (V) ((allPieces & B1D1) == 0) & (V) ((threatened & C1D1) == 0);
+    }
+    else
+    {
+        extraMoves += (V) ((pawns & (CASTLE_FLAG_KING_SIDE << 2)) != 0) & (V) (((allPieces | threatened) & F8G8) == 0);
+        extraMoves += (V) ((pawns & (CASTLE_FLAG_QUEEN_SIDE << 2)) != 0) & (V) ((allPieces & B8D8) == 0) & (V) ((threatened & C8D8) == 0);
+    }
+
+    // 3. king moves
+    countBits(c, kingAttacksV(myKing) & ~(threatened | myPieces));
+
+    // 4. knight moves (one direction at a time, pinned knights can't move)
+    V myKnights = knights & myPieces & notPinned;
+    countBits(c, shiftV<V, 17, ~FILEA>(myKnights) & ~myPieces);
+    countBits(c, shiftV<V, 15, ~FILEH>(myKnights) & ~myPieces);
+    countBits(c, shiftV<V, 10, ~(FILEA | FILEB)>(myKnights) & ~myPieces);
+    countBits(c, shiftV<V,  6, ~(FILEG | FILEH)>(myKnights) & ~myPieces);
+    countBits(c, shiftV<V, -17, ~FILEH>(myKnights) & ~myPieces);
+    countBits(c, shiftV<V, -15, ~FILEA>(myKnights) & ~myPieces);
+    countBits(c, shiftV<V, -10, ~(FILEG | FILEH)>(myKnights) & ~myPieces);
+    countBits(c, shiftV<V,  -6, ~(FILEA | FILEB)>(myKnights) & ~myPieces);
+
+    // 5. sliding moves (one direction at a time, pinned pieces can move only along the line of the pin)
+    V myRooks   = rookQueens & myPieces;
+    V myBishops = bishopQueens & myPieces;
+    V vertical   = myRooks & (notPinned | pinnedVertical);
+    V horizontal = myRooks & (notPinned | pinnedHorizontal);
+    V diagonal   = myBishops & (notPinned | pinnedDiagonal);
+    V antiDiag   = myBishops & (notPinned | pinnedAntiDiag);
+    countBits(c, slideV<V, DIR_NORTH>(vertical, empty) & ~myPieces);
+    countBits(c, slideV<V, DIR_SOUTH>(vertical, empty) & ~myPieces);
+    countBits(c, slideV<V, DIR_EAST> (horizontal, empty) & ~myPieces);
+    countBits(c, slideV<V, DIR_WEST> (horizontal, empty) & ~myPieces);
+    countBits(c, slideV<V, DIR_NORTH_EAST>(diagonal, empty) & ~myPieces);
+    countBits(c, slideV<V, DIR_SOUTH_WEST>(diagonal, empty) & ~myPieces);
+    countBits(c, slideV<V, DIR_NORTH_WEST>(antiDiag, empty) & ~myPieces);
+    countBits(c, slideV<V, DIR_SOUTH_EAST>(antiDiag, empty) & ~myPieces);
+
+    uint32 checkMask = 0;
+    for (int i = 0; i < N; i++)
+    {
+        counts[i] = (uint32) (__builtin_popcountll(c.ones[i]) + 2 * __builtin_popcountll(c.twos[i]) +
+                              4 * __builtin_popcountll(c.fours[i]) + 8 * __builtin_popcountll(c.eights[i]) +
+                              16 * __builtin_popcountll(c.sixteens[i])) - (uint32) extraMoves[i];
+        if (inCheck[i])
+            checkMask |= BIT(i);
+    }
+    return checkMask;
+}
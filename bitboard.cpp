@@ -1,6 +1,15 @@
 #include "chess.h"
 #include "randoms.h"
 
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 // static member variable definations
 ZobristRandoms BitBoardUtils::zob;
 
@@ -27,9 +36,15 @@ uint64 BitBoardUtils::bishopMagics[64];
 uint64 BitBoardUtils::RookAttacksMasked[64];
 uint64 BitBoardUtils::BishopAttacksMasked[64];
 
-uint64   BitBoardUtils::rookMagicAttackTables[64][1 << ROOK_MAGIC_BITS];    // 2 MB
+uint64 (*BitBoardUtils::rookMagicAttackTables)[1 << ROOK_MAGIC_BITS];       // 2 MB
+uint8    BitBoardUtils::rookMagicPageMode;
 uint64 BitBoardUtils::bishopMagicAttackTables[64][1 << BISHOP_MAGIC_BITS];  // 256 KB
 
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+uint8  BitBoardUtils::slidingAttackMode = SLIDING_ATTACKS_PLAIN_MAGICS;
+uint8  BitBoardUtils::simdAttackMode = SIMD_ATTACKS_NONE;
+#endif
+
 
 
 uint8 BitBoardUtils::popCount(uint64 x)
@@ -580,6 +595,26 @@ uint64 BitBoardUtils::rookAttacksKoggeStone(uint64 rooks, uint64 pro)
 uint64 BitBoardUtils::bishopAttacks(uint64 bishop, uint64 pro)
 {
     uint8 square = bitScan(bishop);
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    // the mode is fixed after startup so the branches are perfectly predicted
+    if (slidingAttackMode == SLIDING_ATTACKS_PEXT)
+    {
+        return pextBishopAttacks(square, ~pro);
+    }
+
+    uint64 occ = (~pro) & sqBishopAttacksMasked(square);
+    if (slidingAttackMode == SLIDING_ATTACKS_FANCY_MAGICS)
+    {
+        uint64 index = (bishop_magics_fancy[square].factor * occ) >> (64 - BISHOP_MAGIC_BITS);
+        return fancy_magic_lookup_table[bishop_magics_fancy[square].position + index];
+    }
+    else
+    {
+        uint64 index = (sqBishopMagics(square) * occ) >> (64 - BISHOP_MAGIC_BITS);
+        return sqBishopMagicAttackTables(square, index);
+    }
+#else
     uint64 occ = (~pro) & sqBishopAttacksMasked(square);
 
 #if USE_FANCY_MAGICS == 1
@@ -612,11 +647,31 @@ uint64 BitBoardUtils::bishopAttacks(uint64 bishop, uint64 pro)
     uint64 index = (magic * occ) >> (64 - BISHOP_MAGIC_BITS);
     return sqBishopMagicAttackTables(square, index);
 #endif // USE_FANCY_MAGICS == 1
+#endif // USE_RUNTIME_SLIDING_DISPATCH == 1
 }
 
 uint64 BitBoardUtils::rookAttacks(uint64 rook, uint64 pro)
 {
     uint8 square = bitScan(rook);
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    if (slidingAttackMode == SLIDING_ATTACKS_PEXT)
+    {
+        return pextRookAttacks(square, ~pro);
+    }
+
+    uint64 occ = (~pro) & sqRookAttacksMasked(square);
+    if (slidingAttackMode == SLIDING_ATTACKS_FANCY_MAGICS)
+    {
+        uint64 index = (rook_magics_fancy[square].factor * occ) >> (64 - ROOK_MAGIC_BITS);
+        return fancy_magic_lookup_table[rook_magics_fancy[square].position + index];
+    }
+    else
+    {
+        uint64 index = (sqRookMagics(square) * occ) >> (64 - ROOK_MAGIC_BITS);
+        return sqRookMagicAttackTables(square, index);
+    }
+#else
     uint64 occ = (~pro) & sqRookAttacksMasked(square);
 
 #if USE_FANCY_MAGICS == 1
@@ -648,7 +703,386 @@ uint64 BitBoardUtils::rookAttacks(uint64 rook, uint64 pro)
     uint64 index = (magic * occ) >> (64 - ROOK_MAGIC_BITS);
     return sqRookMagicAttackTables(square, index);
 #endif
+#endif // USE_RUNTIME_SLIDING_DISPATCH == 1
+}
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+TARGET_BMI2 uint64 BitBoardUtils::pextBishopAttacks(uint8 sq, uint64 occ)
+{
+    return pextBishopAttackTable[pextBishopOffset[sq] + _pext_u64(occ, BishopAttacksMasked[sq])];
+}
+
+TARGET_BMI2 uint64 BitBoardUtils::pextRookAttacks(uint8 sq, uint64 occ)
+{
+    return pextRookAttackTable[pextRookOffset[sq] + _pext_u64(occ, RookAttacksMasked[sq])];
+}
+
+static void cpuid(uint32 leaf, uint32 subLeaf, uint32 regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex((int *) regs, leaf, subLeaf);
+#else
+    __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static bool cpuHasBMI2()
+{
+    uint32 regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return false;
+
+    cpuid(7, 0, regs);
+    return !!(regs[1] & BIT(8));
+}
+
+// PEXT if the CPU has (a fast) BMI2 implementation,
+// fancy magics on recent CPUs (smaller tables) and plain magics on older ones (e.g, core 2)
+uint8 BitBoardUtils::detectSlidingAttackMode()
+{
+    uint32 regs[4];
+    cpuid(0, 0, regs);
+    bool isAMD = (regs[1] == 0x68747541);   // "Auth"enticAMD
+
+    cpuid(1, 0, regs);
+    uint32 family = (regs[0] >> 8) & 0xF;
+    if (family == 0xF)
+        family += (regs[0] >> 20) & 0xFF;
+    bool hasAVX = !!(regs[2] & BIT(28));
+
+    // pext is microcoded (very slow) on AMD CPUs before Zen 3
+    if (cpuHasBMI2() && !(isAMD && family < 0x19))
+        return SLIDING_ATTACKS_PEXT;
+
+    if (hasAVX)
+        return SLIDING_ATTACKS_FANCY_MAGICS;
+
+    return SLIDING_ATTACKS_PLAIN_MAGICS;
+}
+
+bool BitBoardUtils::SetSlidingAttackMode(uint8 mode)
+{
+    if (mode == SLIDING_ATTACKS_PEXT)
+    {
+        // allowed even if it's slow on this CPU (e.g, for benchmarking)
+        if (!cpuHasBMI2())
+            return false;
+    }
+    else if (mode != SLIDING_ATTACKS_FANCY_MAGICS && mode != SLIDING_ATTACKS_PLAIN_MAGICS)
+    {
+        return false;
+    }
+
+    slidingAttackMode = mode;
+    return true;
+}
+
+const char *BitBoardUtils::SlidingAttackModeName(uint8 mode)
+{
+    switch (mode)
+    {
+    case SLIDING_ATTACKS_PEXT:
+        return "pext";
+    case SLIDING_ATTACKS_FANCY_MAGICS:
+        return "fancy";
+    default:
+        return "plain";
+    }
+}
+
+// SIMD kogge-stone
+// the 8 ray directions are split into 4 that need a left shift (north, east, north-east, north-west)
+// and 4 that need a right shift (south, west, south-west, south-east). The shift amounts are the same (8, 1, 9, 7) for both.
+// the wrap masks prevent the east/west components of the shifts from wrapping around the board edges.
+#define KS_SHIFTS           8, 1, 9, 7
+#define KS_LEFT_WRAP_MASKS  ALLSET, ~FILEA, ~FILEA, ~FILEH
+#define KS_RIGHT_WRAP_MASKS ALLSET, ~FILEH, ~FILEH, ~FILEA
+
+uint8 BitBoardUtils::detectSimdAttackSupport()
+{
+    uint32 regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return SIMD_ATTACKS_NONE;
+
+    // the OS must also save the (upper halves of) AVX registers on context switch
+    cpuid(1, 0, regs);
+    if (!(regs[2] & BIT(27)))   // OSXSAVE
+        return SIMD_ATTACKS_NONE;
+
+#ifdef _MSC_VER
+    uint64 xcr0 = _xgetbv(0);
+#else
+    uint32 xcr0Lo, xcr0Hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+    uint64 xcr0 = ((uint64) xcr0Hi << 32) | xcr0Lo;
+#endif
+
+    cpuid(7, 0, regs);
+    bool hasAVX2    = !!(regs[1] & BIT(5))  && ((xcr0 & 0x6)  == 0x6);     // XMM and YMM state
+    bool hasAVX512F = !!(regs[1] & BIT(16)) && ((xcr0 & 0xE6) == 0xE6);    // + opmask and ZMM state
+
+#if USE_AVX512_ATTACKS == 1
+    if (hasAVX512F)
+        return SIMD_ATTACKS_AVX512;
+#endif
+
+    return hasAVX2 ? SIMD_ATTACKS_AVX2 : SIMD_ATTACKS_NONE;
+}
+
+// occluded fill (one direction per lane) followed by one step shift, i.e, attacks of all the sliders in gen
+// pro - empty squares
+TARGET_AVX2 static inline __m256i leftAttacksAVX2(__m256i gen, __m256i pro, __m256i shift, __m256i wrapMask)
+{
+    __m256i shift2 = _mm256_add_epi64(shift, shift);
+    __m256i shift4 = _mm256_add_epi64(shift2, shift2);
+
+    pro = _mm256_and_si256(pro, wrapMask);
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift)));
+    pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift2)));
+    pro = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift2));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_sllv_epi64(gen, shift4)));
+
+    return _mm256_and_si256(_mm256_sllv_epi64(gen, shift), wrapMask);
+}
+
+TARGET_AVX2 static inline __m256i rightAttacksAVX2(__m256i gen, __m256i pro, __m256i shift, __m256i wrapMask)
+{
+    __m256i shift2 = _mm256_add_epi64(shift, shift);
+    __m256i shift4 = _mm256_add_epi64(shift2, shift2);
+
+    pro = _mm256_and_si256(pro, wrapMask);
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift)));
+    pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift2)));
+    pro = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift2));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, _mm256_srlv_epi64(gen, shift4)));
+
+    return _mm256_and_si256(_mm256_srlv_epi64(gen, shift), wrapMask);
+}
+
+TARGET_AVX2 static inline uint64 reduceOrAVX2(__m256i x)
+{
+    __m128i r = _mm_or_si128(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    return (uint64) (_mm_cvtsi128_si64(r) | _mm_extract_epi64(r, 1));
+}
+
+// combined attacks of all the given bishops (and queens) and rooks (and queens)
+TARGET_AVX2 static uint64 slidingAttacksAVX2(uint64 bishops, uint64 rooks, uint64 pro)
+{
+    const __m256i shift     = _mm256_setr_epi64x(KS_SHIFTS);
+    const __m256i leftWrap  = _mm256_setr_epi64x(KS_LEFT_WRAP_MASKS);
+    const __m256i rightWrap = _mm256_setr_epi64x(KS_RIGHT_WRAP_MASKS);
+
+    __m256i gen  = _mm256_setr_epi64x(rooks, rooks, bishops, bishops);
+    __m256i vpro = _mm256_set1_epi64x(pro);
+
+    __m256i attacks = _mm256_or_si256(leftAttacksAVX2 (gen, vpro, shift, leftWrap),
+                                      rightAttacksAVX2(gen, vpro, shift, rightWrap));
+    return reduceOrAVX2(attacks);
+}
+
+// pieces pinned to the king: the first piece seen from the king in a direction is pinned if the
+// next piece in the same direction is an enemy slider that moves in that direction
+TARGET_AVX2 static uint64 pinnedPiecesAVX2(uint64 myKing, uint64 enemyBishops, uint64 enemyRooks, uint64 allPieces)
+{
+    const __m256i shift     = _mm256_setr_epi64x(KS_SHIFTS);
+    const __m256i leftWrap  = _mm256_setr_epi64x(KS_LEFT_WRAP_MASKS);
+    const __m256i rightWrap = _mm256_setr_epi64x(KS_RIGHT_WRAP_MASKS);
+    const __m256i zero      = _mm256_setzero_si256();
+
+    __m256i king    = _mm256_set1_epi64x(myKing);
+    __m256i pieces  = _mm256_set1_epi64x(allPieces);
+    __m256i empty   = _mm256_set1_epi64x(~allPieces);
+    __m256i sliders = _mm256_setr_epi64x(enemyRooks, enemyRooks, enemyBishops, enemyBishops);
+
+    __m256i firstLeft  = _mm256_and_si256(leftAttacksAVX2 (king, empty, shift, leftWrap),  pieces);
+    __m256i firstRight = _mm256_and_si256(rightAttacksAVX2(king, empty, shift, rightWrap), pieces);
+
+    __m256i hitLeft  = _mm256_and_si256(leftAttacksAVX2 (firstLeft,  empty, shift, leftWrap),  sliders);
+    __m256i hitRight = _mm256_and_si256(rightAttacksAVX2(firstRight, empty, shift, rightWrap), sliders);
+
+    __m256i pinned = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi64(hitLeft,  zero), firstLeft),
+                                     _mm256_andnot_si256(_mm256_cmpeq_epi64(hitRight, zero), firstRight));
+    return reduceOrAVX2(pinned);
+}
+
+#if USE_AVX512_ATTACKS == 1
+// lo goes to lanes 0-3, hi to lanes 4-7
+TARGET_AVX512 static inline __m512i combineAVX512(__m256i lo, __m256i hi)
+{
+    return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+}
+
+// lanes 0-3 shift left, lanes 4-7 shift right
+TARGET_AVX512 static inline __m512i shiftAVX512(__m512i x, __m512i shift)
+{
+    return _mm512_mask_srlv_epi64(_mm512_sllv_epi64(x, shift), 0xF0, x, shift);
+}
+
+TARGET_AVX512 static inline __m512i attacksAVX512(__m512i gen, __m512i pro, __m512i shift, __m512i wrapMask)
+{
+    __m512i shift2 = _mm512_add_epi64(shift, shift);
+    __m512i shift4 = _mm512_add_epi64(shift2, shift2);
+
+    pro = _mm512_and_si512(pro, wrapMask);
+    gen = _mm512_or_si512(gen, _mm512_and_si512(pro, shiftAVX512(gen, shift)));
+    pro = _mm512_and_si512(pro, shiftAVX512(pro, shift));
+    gen = _mm512_or_si512(gen, _mm512_and_si512(pro, shiftAVX512(gen, shift2)));
+    pro = _mm512_and_si512(pro, shiftAVX512(pro, shift2));
+    gen = _mm512_or_si512(gen, _mm512_and_si512(pro, shiftAVX512(gen, shift4)));
+
+    return _mm512_and_si512(shiftAVX512(gen, shift), wrapMask);
+}
+
+TARGET_AVX512 static uint64 slidingAttacksAVX512(uint64 bishops, uint64 rooks, uint64 pro)
+{
+    const __m512i shift = combineAVX512(_mm256_setr_epi64x(KS_SHIFTS), _mm256_setr_epi64x(KS_SHIFTS));
+    const __m512i wrap  = combineAVX512(_mm256_setr_epi64x(KS_LEFT_WRAP_MASKS), _mm256_setr_epi64x(KS_RIGHT_WRAP_MASKS));
+
+    __m512i gen = _mm512_setr_epi64(rooks, rooks, bishops, bishops, rooks, rooks, bishops, bishops);
+
+    return (uint64) _mm512_reduce_or_epi64(attacksAVX512(gen, _mm512_set1_epi64(pro), shift, wrap));
+}
+
+TARGET_AVX512 static uint64 pinnedPiecesAVX512(uint64 myKing, uint64 enemyBishops, uint64 enemyRooks, uint64 allPieces)
+{
+    const __m512i shift = combineAVX512(_mm256_setr_epi64x(KS_SHIFTS), _mm256_setr_epi64x(KS_SHIFTS));
+    const __m512i wrap  = combineAVX512(_mm256_setr_epi64x(KS_LEFT_WRAP_MASKS), _mm256_setr_epi64x(KS_RIGHT_WRAP_MASKS));
+
+    __m512i empty   = _mm512_set1_epi64(~allPieces);
+    __m512i sliders = _mm512_setr_epi64(enemyRooks, enemyRooks, enemyBishops, enemyBishops,
+                                        enemyRooks, enemyRooks, enemyBishops, enemyBishops);
+
+    __m512i first = _mm512_and_si512(attacksAVX512(_mm512_set1_epi64(myKing), empty, shift, wrap), _mm512_set1_epi64(allPieces));
+    __mmask8 hit  = _mm512_test_epi64_mask(attacksAVX512(first, empty, shift, wrap), sliders);
+
+    return (uint64) _mm512_reduce_or_epi64(_mm512_maskz_mov_epi64(hit, first));
+}
+#endif
+
+bool BitBoardUtils::SetSimdAttackMode(uint8 mode)
+{
+    if (mode > detectSimdAttackSupport())
+        return false;
+
+    simdAttackMode = mode;
+    return true;
+}
+
+const char *BitBoardUtils::SimdAttackModeName(uint8 mode)
+{
+    switch (mode)
+    {
+    case SIMD_ATTACKS_AVX512:
+        return "avx512";
+    case SIMD_ATTACKS_AVX2:
+        return "avx2";
+    default:
+        return "off";
+    }
+}
+
+// inputs of findAttackedSquares/findPinnedPieces for a position
+struct AttackBenchInput
+{
+    uint64 allPieces;
+    uint64 enemyBishops;
+    uint64 enemyRooks;
+    uint64 enemyPawns;
+    uint64 enemyKnights;
+    uint64 enemyKing;
+    uint64 myKing;
+    uint8  kingIndex;
+    uint8  enemyColor;
+};
+
+void BitBoardUtils::BenchmarkSimdAttacks(HexaBitBoardPosition *positions, int nPositions, int iterations)
+{
+    AttackBenchInput *inputs = (AttackBenchInput *) malloc(sizeof(AttackBenchInput) * nPositions);
+    for (int i = 0; i < nPositions; i++)
+    {
+        ExpandedBitBoard bb = (positions[i].chance == WHITE) ? ExpandBitBoard<WHITE>(&positions[i]) : ExpandBitBoard<BLACK>(&positions[i]);
+        inputs[i].allPieces    = bb.allPieces;
+        inputs[i].enemyBishops = bb.enemyBishopQueens;
+        inputs[i].enemyRooks   = bb.enemyRookQueens;
+        inputs[i].enemyPawns   = bb.enemyPawns;
+        inputs[i].enemyKnights = bb.enemyKnights;
+        inputs[i].enemyKing    = bb.enemyKing;
+        inputs[i].myKing       = bb.myKing;
+        inputs[i].kingIndex    = bb.myKingIndex;
+        inputs[i].enemyColor   = !positions[i].chance;
+    }
+
+    uint8 savedMode = simdAttackMode;
+    uint8 supported = detectSimdAttackSupport();
+    uint64 refAttacks = 0, refAll = 0;
+    double calls = (double) nPositions * iterations;
+
+    printf("%d positions x %d iterations, magics using %s\n", nPositions, iterations, SlidingAttackModeName(slidingAttackMode));
+    for (uint8 mode = SIMD_ATTACKS_NONE; mode <= supported; mode++)
+    {
+        simdAttackMode = mode;
+
+        // 1. just the attacks of all bishops and rooks (multiBishopAttacks + multiRookAttacks for magics)
+        uint64 checkAttacks = 0;
+        Timer timer;
+        timer.start();
+        for (int it = 0; it < iterations; it++)
+        {
+            for (int i = 0; i < nPositions; i++)
+            {
+                AttackBenchInput &in = inputs[i];
+                uint64 pro = ~in.allPieces | in.myKing;
+                uint64 attacks;
+#if USE_AVX512_ATTACKS == 1
+                if (mode == SIMD_ATTACKS_AVX512)
+                    attacks = slidingAttacksAVX512(in.enemyBishops, in.enemyRooks, pro);
+                else
+#endif
+                if (mode == SIMD_ATTACKS_AVX2)
+                    attacks = slidingAttacksAVX2(in.enemyBishops, in.enemyRooks, pro);
+                else
+                    attacks = multiBishopAttacks(in.enemyBishops, pro) | multiRookAttacks(in.enemyRooks, pro);
+
+                checkAttacks = (checkAttacks ^ attacks) * C64(0x9E3779B97F4A7C15);
+            }
+        }
+        double attacksTime = (double) timer.getElapsedMicroSeconds();
+
+        // 2. attacked squares and pinned pieces (as done by ExpandBitBoard)
+        uint64 checkAll = 0;
+        timer.start();
+        for (int it = 0; it < iterations; it++)
+        {
+            for (int i = 0; i < nPositions; i++)
+            {
+                AttackBenchInput &in = inputs[i];
+                uint64 threatened = findAttackedSquares(~in.allPieces, in.enemyBishops, in.enemyRooks, in.enemyPawns, in.enemyKnights,
+                                                        in.enemyKing, in.myKing, in.enemyColor);
+                uint64 pinned = findPinnedPieces(in.myKing, in.enemyBishops, in.enemyRooks, in.allPieces, in.kingIndex);
+                checkAll = (checkAll ^ threatened ^ (pinned << 1)) * C64(0x9E3779B97F4A7C15);
+            }
+        }
+        double allTime = (double) timer.getElapsedMicroSeconds();
+
+        if (mode == SIMD_ATTACKS_NONE)
+        {
+            refAttacks = checkAttacks;
+            refAll = checkAll;
+        }
+
+        printf("%-7s sliding attacks: %6.2f ns, attacked squares + pinned pieces: %6.2f ns per position%s\n",
+               SimdAttackModeName(mode), attacksTime * 1000 / calls, allTime * 1000 / calls,
+               (checkAttacks == refAttacks && checkAll == refAll) ? "" : " MISMATCH!");
+    }
+
+    simdAttackMode = savedMode;
+    free(inputs);
 }
+#endif
 
 uint64 BitBoardUtils::multiBishopAttacks(uint64 bishops, uint64 pro)
 {
@@ -846,6 +1280,15 @@ uint64 BitBoardUtils::findPinnedPieces(uint64 myKing, uint64 enemyBishops, uint6
     uint64 r = rookAttacks  (myKing, ~enemyPieces) & enemyRooks;
     */
 
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+#if USE_AVX512_ATTACKS == 1
+    if (simdAttackMode == SIMD_ATTACKS_AVX512)
+        return pinnedPiecesAVX512(myKing, enemyBishops, enemyRooks, allPieces);
+#endif
+    if (simdAttackMode == SIMD_ATTACKS_AVX2)
+        return pinnedPiecesAVX2(myKing, enemyBishops, enemyRooks, allPieces);
+#endif
+
     uint64 b = sqBishopAttacks(kingIndex) & enemyBishops;
     uint64 r = sqRookAttacks(kingIndex)   & enemyRooks;
 
@@ -901,11 +1344,24 @@ uint64 BitBoardUtils::findAttackedSquares(uint64 emptySquares, uint64 enemyBisho
     attacked |= knightAttacks(enemyKnights);
 #endif
 
-    // 3. bishop attacks
-    attacked |= multiBishopAttacks(enemyBishops, emptySquares | myKing); // squares behind king are also under threat (in the sense that king can't go there)
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    // 3 & 4. bishop and rook attacks together (all directions at once)
+#if USE_AVX512_ATTACKS == 1
+    if (simdAttackMode == SIMD_ATTACKS_AVX512)
+        attacked |= slidingAttacksAVX512(enemyBishops, enemyRooks, emptySquares | myKing);
+    else
+#endif
+    if (simdAttackMode == SIMD_ATTACKS_AVX2)
+        attacked |= slidingAttacksAVX2(enemyBishops, enemyRooks, emptySquares | myKing);
+    else
+#endif
+    {
+        // 3. bishop attacks
+        attacked |= multiBishopAttacks(enemyBishops, emptySquares | myKing); // squares behind king are also under threat (in the sense that king can't go there)
 
-    // 4. rook attacks
-    attacked |= multiRookAttacks(enemyRooks, emptySquares | myKing); // squares behind king are also under threat
+        // 4. rook attacks
+        attacked |= multiRookAttacks(enemyRooks, emptySquares | myKing); // squares behind king are also under threat
+    }
 
     // 5. King attacks
 #if USE_KING_LUT == 1
@@ -921,10 +1377,23 @@ uint64 BitBoardUtils::findAttackedSquares(uint64 emptySquares, uint64 enemyBisho
     return attacked/*& (emptySquares)*/;
 }
 
+// the en-passent target is hashed only if a pawn of the given side can actually capture it
+// (used by makeMove, ComputeZobristKey and the null move so that they all compute the same key)
+bool BitBoardUtils::IsEnPassentPossible(HexaBitBoardPosition *pos, uint8 chance)
+{
+    if (!pos->enPassent)
+        return false;
+
+    // the pawn that can be captured en-passent (on rank 5 for white to move, rank 4 for black)
+    uint64 enPassentCapturedPiece = BIT(pos->enPassent - 1) << (8 * ((chance == WHITE) ? 4 : 3));
+    uint64 myPawns = pos->pawns & RANKS2TO7 & ((chance == WHITE) ? pos->whitePieces : ~pos->whitePieces);
+
+    return !!((eastOne(enPassentCapturedPiece) | westOne(enPassentCapturedPiece)) & myPawns);
+}
 
 
 template <uint8 chance>
-void BitBoardUtils::makeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move)
+void BitBoardUtils::makeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move, EvalState *evalState)
 {
     uint64 src = BIT(move.getFrom());
     uint64 dst = BIT(move.getTo());
@@ -960,31 +1429,83 @@ void BitBoardUtils::makeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move
     else if (move.getFlags() == CM_FLAG_QUEEN_PROMOTION || move.getFlags() == CM_FLAG_QUEEN_PROMO_CAP)
         piece = QUEEN;
 
-#if INCREMENTAL_ZOBRIST_UPDATE == 1
+    // figure out destination (captured) piece
+    uint8 dstPiece = 0;
+    if (pos->kings & dst)
+        dstPiece = KING;
+    else if (pos->knights & dst)
+        dstPiece = KNIGHT;
+    else if ((pos->pawns & RANKS2TO7) & dst)
+        dstPiece = PAWN;
+    else if (queens & dst)
+        dstPiece = QUEEN;
+    else if (pos->bishopQueens & dst)
+        dstPiece = BISHOP;
+    else if (pos->rookQueens & dst)
+        dstPiece = ROOK;
 
-    // remove captured piece from dst
+    if (evalState)
     {
-        uint8 dstPiece = 0;
-        // figure out destination piece
-        if (pos->kings & dst)
-            dstPiece = KING;
-        else if (pos->knights & dst)
-            dstPiece = KNIGHT;
-        else if ((pos->pawns & RANKS2TO7) & dst)
-            dstPiece = PAWN;
-        else if (queens & dst)
-            dstPiece = QUEEN;
-        else if (pos->bishopQueens & dst)
-            dstPiece = BISHOP;
-        else if (pos->rookQueens & dst)
-            dstPiece = ROOK;
+        uint8 srcPiece = (move.getFlags() & CM_FLAG_PROMOTION) ? PAWN : piece;
 
+        // material, piece-square scores and phase: moving piece (gets promoted if it's a promotion)
+        evalState->material += pieceMaterial[chance][piece] - pieceMaterial[chance][srcPiece];
+        evalState->psq += pieceSquareScore[chance][piece][move.getTo()] - pieceSquareScore[chance][srcPiece][move.getFrom()];
+        evalState->phase += piecePhase[piece] - piecePhase[srcPiece];
+
+        // captured piece
         if (dstPiece)
         {
-            hash ^= zob.pieces[!chance][dstPiece - 1][move.getTo()];
+            evalState->material -= pieceMaterial[!chance][dstPiece];
+            evalState->psq -= pieceSquareScore[!chance][dstPiece][move.getTo()];
+            evalState->phase -= piecePhase[dstPiece];
+        }
+
+        // pawn hash changes only when a pawn moves, gets captured or promoted
+        if (srcPiece == PAWN)
+        {
+            evalState->pawnHash ^= zob.pieces[chance][ZOB_INDEX_PAWN][move.getFrom()];
+            if (piece == PAWN)
+                evalState->pawnHash ^= zob.pieces[chance][ZOB_INDEX_PAWN][move.getTo()];
+
+            if (move.getFlags() == CM_FLAG_EP_CAPTURE)
+            {
+                uint8 epSquare = (chance == WHITE) ? move.getTo() - 8 : move.getTo() + 8;
+                evalState->pawnHash ^= zob.pieces[!chance][ZOB_INDEX_PAWN][epSquare];
+                evalState->material -= pieceMaterial[!chance][PAWN];
+                evalState->psq -= pieceSquareScore[!chance][PAWN][epSquare];
+            }
+        }
+
+        if (dstPiece == PAWN)
+            evalState->pawnHash ^= zob.pieces[!chance][ZOB_INDEX_PAWN][move.getTo()];
+
+        // rook moved by castling
+        if (move.getFlags() == CM_FLAG_KING_CASTLE || move.getFlags() == CM_FLAG_QUEEN_CASTLE)
+        {
+            uint8 rookFrom, rookTo;
+            if (move.getFlags() == CM_FLAG_KING_CASTLE)
+            {
+                rookFrom = (chance == WHITE) ? H1 : H8;
+                rookTo   = (chance == WHITE) ? F1 : F8;
+            }
+            else
+            {
+                rookFrom = (chance == WHITE) ? A1 : A8;
+                rookTo   = (chance == WHITE) ? D1 : D8;
+            }
+            evalState->psq += pieceSquareScore[chance][ROOK][rookTo] - pieceSquareScore[chance][ROOK][rookFrom];
         }
     }
 
+#if INCREMENTAL_ZOBRIST_UPDATE == 1
+
+    // remove captured piece from dst
+    if (dstPiece)
+    {
+        hash ^= zob.pieces[!chance][dstPiece - 1][move.getTo()];
+    }
+
     // add moving piece at dst
     hash ^= zob.pieces[chance][piece - 1][move.getTo()];
 
@@ -1005,7 +1526,8 @@ void BitBoardUtils::makeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move
 
 
     // en-passent target
-    if (pos->enPassent)
+    // (hashed only if en-passent capture is possible)
+    if (IsEnPassentPossible(pos, chance))
     {
         hash ^= zob.enPassentTarget[pos->enPassent - 1];
     }
@@ -1149,8 +1671,8 @@ void BitBoardUtils::makeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move
         hash ^= zob.castlingRights[BLACK][1];
 
 
-    // en-passent target
-    if (pos->enPassent)
+    // en-passent target (the opponent is the side to move now)
+    if (IsEnPassentPossible(pos, !chance))
     {
         hash ^= zob.enPassentTarget[pos->enPassent - 1];
     }
@@ -1187,29 +1709,10 @@ uint64 BitBoardUtils::ComputeZobristKey(HexaBitBoardPosition *pos)
     uint64 allPawns = pos->pawns & RANKS2TO7;    // get rid of game state variables
     uint64 allPieces = pos->kings | allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
 
-    // en-passent target
-    if (pos->enPassent)
+    // en-passent target (only if en-passent is possible)
+    if (IsEnPassentPossible(pos, chance))
     {
-        uint64 blackPieces = allPieces & (~pos->whitePieces);
-        uint64 myPieces = (chance == WHITE) ? pos->whitePieces : blackPieces;
-        uint64 myPawns = allPawns & myPieces;
-
-        // only update the flag if en-passent is possible
-        uint64 enPassentCapturedPiece;
-        if (chance == BLACK)
-        {
-            enPassentCapturedPiece = BIT(pos->enPassent - 1) << (8 * 3);
-        }
-        else
-        {
-            enPassentCapturedPiece = BIT(pos->enPassent - 1) << (8 * 4);
-        }
-        uint64 epSources = (eastOne(enPassentCapturedPiece) | westOne(enPassentCapturedPiece)) & myPawns;
-
-        if (epSources)
-        {
-            key ^= zob.enPassentTarget[pos->enPassent - 1];
-        }
+        key ^= zob.enPassentTarget[pos->enPassent - 1];
     }
 
     // piece-position
@@ -1251,6 +1754,38 @@ uint64 BitBoardUtils::ComputeZobristKey(HexaBitBoardPosition *pos)
     return key;
 }
 
+uint64 BitBoardUtils::ComputePawnHash(HexaBitBoardPosition *pos)
+{
+    uint64 key = 0;
+    uint64 allPawns = pos->pawns & RANKS2TO7;
+    while (allPawns)
+    {
+        uint64 pawn = getOne(allPawns);
+        int color = !(pawn & pos->whitePieces);
+        key ^= zob.pieces[color][ZOB_INDEX_PAWN][bitScan(pawn)];
+        allPawns ^= pawn;
+    }
+
+    return key;
+}
+
+void BitBoardUtils::ComputeEvalState(HexaBitBoardPosition *pos, EvalState *evalState)
+{
+    evalState->pawnHash = ComputePawnHash(pos);
+    computeMaterialAndPST(pos, evalState);
+}
+
+bool BitBoardUtils::verifyEvalState(HexaBitBoardPosition *pos, const EvalState &evalState)
+{
+    EvalState expected;
+    ComputeEvalState(pos, &expected);
+
+    return evalState.pawnHash == expected.pawnHash &&
+           evalState.material == expected.material &&
+           evalState.psq      == expected.psq      &&
+           evalState.phase    == expected.phase;
+}
+
 
 
 
@@ -1301,6 +1836,12 @@ void BitBoardUtils::init()
 
     // initialize magic lookup tables
 #if USE_SLIDING_LUT == 1
+    // the rook table is randomly accessed and exactly 2 MB - a good fit for a single large page
+    if (rookMagicAttackTables == NULL)
+    {
+        rookMagicAttackTables = (uint64 (*)[1 << ROOK_MAGIC_BITS]) Utils::LargePageAlloc(sizeof(uint64) * 64 * (1 << ROOK_MAGIC_BITS), &rookMagicPageMode);
+    }
+
     srand(time(NULL));
     for (int square = A1; square <= H8; square++)
     {
@@ -1324,7 +1865,7 @@ void BitBoardUtils::init()
 
         mask = sqBishopAttacks(square)  & (~thisSquare) & CENTRAL_SQUARES;
         BishopAttacksMasked[square] = mask;
-#if USE_FANCY_MAGICS != 1
+#if USE_FANCY_MAGICS != 1 || USE_RUNTIME_SLIDING_DISPATCH == 1
         rookMagics[square]   = findRookMagicForSquare(square, rookMagicAttackTables[square]);
         bishopMagics[square] = findBishopMagicForSquare(square, bishopMagicAttackTables[square]);
 #endif
@@ -1356,7 +1897,15 @@ void BitBoardUtils::init()
 
     //printf("\ntotal bishop unique attacks: %d\n", globalOffsetBishop);
     //printf("\ntotal rook unique attacks: %d\n", globalOffsetRook);
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    initPextTables();
+    slidingAttackMode = detectSlidingAttackMode();
+    simdAttackMode = GetDefaultSimdAttackMode();
+#endif
 #endif        
+
+    initEvalTables();
 }
 
 
@@ -1375,6 +1924,22 @@ void BitBoardUtils::MakeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move
     }
 }
 
+void BitBoardUtils::MakeMove(HexaBitBoardPosition *pos, uint64 &hash, EvalState &evalState, CMove move)
+{
+    if (pos->chance == WHITE)
+    {
+        BitBoardUtils::makeMove<WHITE>(pos, hash, move, &evalState);
+    }
+    else
+    {
+        BitBoardUtils::makeMove<BLACK>(pos, hash, move, &evalState);
+    }
+
+#if VERIFY_EVAL_STATE == 1
+    assert(verifyEvalState(pos, evalState));
+#endif
+}
+
 // Ankan - TODO: check if this can be optimized? Maybe simplify the bitboard structure?
 bool BitBoardUtils::IsInCheck(HexaBitBoardPosition *pos)
 {
@@ -1509,8 +2074,8 @@ bool BitBoardUtils::IsIrReversibleMove(HexaBitBoardPosition *pos, CMove move)
 template ExpandedBitBoard BitBoardUtils::ExpandBitBoard<WHITE>(HexaBitBoardPosition *pos);
 template ExpandedBitBoard BitBoardUtils::ExpandBitBoard<BLACK>(HexaBitBoardPosition *pos);
 
-template void BitBoardUtils::makeMove<WHITE>(HexaBitBoardPosition *pos, uint64 &hash, CMove move);
-template void BitBoardUtils::makeMove<BLACK>(HexaBitBoardPosition *pos, uint64 &hash, CMove move);
+template void BitBoardUtils::makeMove<WHITE>(HexaBitBoardPosition *pos, uint64 &hash, CMove move, EvalState *evalState);
+template void BitBoardUtils::makeMove<BLACK>(HexaBitBoardPosition *pos, uint64 &hash, CMove move, EvalState *evalState);
 
 
 
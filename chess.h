@@ -3,7 +3,9 @@
 #include "switches.h"
 #include <stdio.h>
 #include <string.h>
+#include <float.h>
 #include <thread>
+#include <atomic>
 #include <chrono>
 #include "timer.h"
 
@@ -36,6 +38,35 @@ int __static_assert(int static_assert_failed[(expr)?1:-1])
 
 #define BIT(i)   (1ULL << (i))
 
+// align to cache line size (to avoid false sharing between threads)
+#ifdef _MSC_VER
+#define CACHE_ALIGN __declspec(align(64))
+#else
+#define CACHE_ALIGN __attribute__((aligned(64)))
+#endif
+
+// allow use of BMI2 instructions in a function (even when the rest of the code is compiled for older CPUs)
+// such functions must be called only after checking that the CPU supports BMI2
+#ifdef _MSC_VER
+#define TARGET_BMI2
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_BMI2 __attribute__((target("bmi2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// sliding piece attack backends (selected at runtime when USE_RUNTIME_SLIDING_DISPATCH is enabled)
+#define SLIDING_ATTACKS_PLAIN_MAGICS    0
+#define SLIDING_ATTACKS_FANCY_MAGICS    1
+#define SLIDING_ATTACKS_PEXT            2
+
+// SIMD kogge-stone paths for findAttackedSquares/findPinnedPieces (also selected at runtime)
+#define SIMD_ATTACKS_NONE               0
+#define SIMD_ATTACKS_AVX2               1       // 4 directions per instruction
+#define SIMD_ATTACKS_AVX512             2       // all 8 directions per instruction
+
 // Terminology:
 //
 // file - column [A - H]
@@ -312,6 +343,21 @@ code	promotion	capture	special 1	special 0	kind of move
 #define MAX_GAME_LENGTH 1024
 #define MATE_SCORE_BASE 16384
 
+#if USE_BATCHED_MOVE_COUNT == 1
+// structure-of-arrays layout of a set of board positions (e.g, all the children of a node)
+// each array has the same meaning as the corresponding field of HexaBitBoardPosition
+// (the arrays are padded to a multiple of the SIMD width, the padding positions are never used)
+struct __attribute__((aligned(64))) HexaBitBoardBatch
+{
+    uint64   whitePieces[MAX_MOVES];
+    uint64   pawns[MAX_MOVES];
+    uint64   knights[MAX_MOVES];
+    uint64   bishopQueens[MAX_MOVES];
+    uint64   rookQueens[MAX_MOVES];
+    uint64   kings[MAX_MOVES];
+};
+#endif
+
 // max no of moves possible by a single piece
 // actually it's 27 for a queen when it's in the center of the board
 #define MAX_SINGLE_PIECE_MOVES 32
@@ -320,13 +366,16 @@ code	promotion	capture	special 1	special 0	kind of move
 #define MAX_CAPTURE_SEQ_LENGTH 32
 
 // random numbers for zobrist hashing
+// max depth supported by hashed perft
+#define MAX_PERFT_DEPTH 32
+
 struct ZobristRandoms
 {
     uint64 pieces[2][6][64];     // position of every piece on board
     uint64 castlingRights[2][2]; // king side and queen side castle for each side
     uint64 enPassentTarget[8];   // 8 possible files for en-passent target (if any)
     uint64 chance;               // chance (side to move)
-    uint64 depth;                // search depth (used only by perft)
+    uint64 depth[MAX_PERFT_DEPTH]; // search depth (used only by hashed perft)
 };
 
 
@@ -370,6 +419,11 @@ For all other purposes the 0x88 board is used
 
 */
 
+// type of memory pages obtained by Utils::LargePageAlloc
+#define PAGE_MODE_REGULAR   0       // regular (4 KB) pages
+#define PAGE_MODE_THP       1       // transparent huge pages requested using madvise (linux)
+#define PAGE_MODE_HUGETLB   2       // explicit huge pages (MAP_HUGETLB on linux, MEM_LARGE_PAGES on windows)
+
 class Utils {
 
 private:
@@ -411,6 +465,18 @@ public:
     static void clearBoard(BoardPosition088 *pos);
 
     static int  readMove(const char *input, const HexaBitBoardPosition *pos, CMove* move);
+
+    // run perft on all the positions of an epd file and compare against the perft values in the file
+    // (positions are processed in parallel using the given no. of threads)
+    static void testPerftFile(const char *fileName, int maxDepth, int nThreads);
+
+    // allocate memory backed by large (2 MB) pages if possible, falls back to regular pages
+    // type of pages obtained is returned in pageMode (one of the PAGE_MODE_* values)
+    static void *LargePageAlloc(uint64 size, uint8 *pageMode);
+    static void  LargePageFree(void *mem, uint64 size, uint8 pageMode);
+
+    // human readable name for a PAGE_MODE_* value
+    static const char *PageModeName(uint8 pageMode);
 };
 
 
@@ -427,6 +493,26 @@ private:
     static void WorkerThreadMain();
 
     static void Search_Go(char *params);
+
+    // handle "setoption name <id> value <x>" command
+    static void SetOption(char *params);
+
+    // initialize move generation tables and TT (if not already done by the "uci" command)
+    static void InitTables();
+
+    // handle "bench [depth] [threads]" command
+    // fixed depth search of a set of built-in positions
+    static void Bench(char *params);
+
+    // handle "seebench [games] [iterations]" command
+    // compares the fast (swap list) SEE with the reference SEE over positions from random games
+    static void SeeBench(char *params);
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    // handle "attackbench [iterations]" command
+    // times scalar vs SIMD attack generation over positions derived from the bench set
+    static void AttackBench(char *params);
+#endif
 public:
 
     // process commands from standard input one by one
@@ -434,98 +520,273 @@ public:
 
 };
 
-class Game
+// middle game and end game scores packed in a single int32 (end game score in the upper 16 bits)
+// so that both can be accumulated with a single add
+#define MAKE_SCORE(mg, eg) ((int32) ((uint32) (eg) << 16) + (int32) (mg))
+#define MG_SCORE(s)        ((int16) (uint16) (uint32) (s))
+#define EG_SCORE(s)        ((int16) (uint16) ((uint32) ((s) + 0x8000) >> 16))
+
+// game phase is the sum of phase values of all knights, bishops, rooks and queens on the board
+// (1 for minor pieces, 2 for rooks and 4 for queens) - and is MAX_PHASE at the start of the game
+#define MAX_PHASE 24
+
+// evaluation related state that is updated incrementally by makeMove
+// carried along with the position (and it's hash) during search
+struct EvalState
 {
-private:
-    // timer to check how much time is remaining and elapsed
-    static Timer timer;
+    // zobrist key of just the pawns (used to index the pawn hash table)
+    uint64 pawnHash;
 
-    // the current board position
-    static HexaBitBoardPosition pos;
+    // packed middle/end game piece-square score from white's point of view
+    int32  psq;
+
+    // material score from white's point of view (bishop pair bonus is not included)
+    int16  material;
+
+    // game phase (can exceed MAX_PHASE after promotions)
+    int16  phase;
+};
+
+// pawn structure eval depends only on the position of pawns, so it's cached in a small per-thread hash table
+struct PawnHashEntry
+{
+    uint64 pawnHash;
+    uint64 passedPawns[2];      // white and black passed pawns
+
+    int16  score;               // doubled pawn penalty
+    int16  passedPawnScore;     // passed pawn bonus (halved for middle game)
+};
+CT_ASSERT(sizeof(PawnHashEntry) == 32);
+
+// state of a single search thread
+// everything that the search routines modify (apart from the shared transposition table) lives here
+// so that multiple searches (e.g, helper threads of lazy SMP) can run independently without sharing any state.
+// allocated cache line aligned (one per thread) to avoid false sharing between threads
+struct CACHE_ALIGN SearchContext
+{
+    // index of the search thread (0 is the main thread)
+    int    threadId;
+
+    // set to make the search abort as soon as possible
+    // (by other threads, or by the search itself when the time limit is exceeded)
+    std::atomic<bool> stop;
+
+    // no of nodes searched by this thread
+    uint64 nodes;
+
+    // nodes visited since the last check for timeout
+    uint32 nodesSinceStopCheck;
+
+    // timer to check how much time is remaining and elapsed
+    Timer  timer;
 
     // time to search for (in ms)
-    static int searchTime;
+    int    searchTime;
 
     // max time limit (in ms)
     // the search must be aborted if we exceed this
-    static int searchTimeLimit;
-
-    static int maxSearchDepth;
+    int    searchTimeLimit;
 
-    // the best move found so far (TODO: protect this in a Critical Section)
-    static CMove bestMove;
+    // the best move found so far
+    CMove  bestMove;
 
     // the principal variation for the current search
-    static CMove pv[MAX_GAME_LENGTH];
+    CMove  pv[MAX_GAME_LENGTH];
 
     // length of available PV
-    static int pvLen;
+    int    pvLen;
 
     // to detect repetitions (and avoid/cause draw based on it)
-    // plyNo is relative to the position provided in "position" uci command
-    static uint64 posHashes[MAX_GAME_LENGTH];
-    static int    plyNo;
+    // game history is copied here when search starts
+    uint64 posHashes[MAX_GAME_LENGTH];
+
+    // killer moves
+    CMove  killers[MAX_GAME_LENGTH][MAX_KILLERS];
 
     // used for history heuristic
     // TODO: also consider storing these per piece type?
 #if HISTORY_PER_PIECE == 1
-    static uint32 historyScore[2][6][64][64];
-    static uint32 butterflyScore[2][6][64][64];
+    uint32 historyScore[2][6][64][64];
+    uint32 butterflyScore[2][6][64][64];
 #else
-    static uint32 historyScore[2][64][64];
-    static uint32 butterflyScore[2][64][64];
+    uint32 historyScore[2][64][64];
+    uint32 butterflyScore[2][64][64];
+#endif
+
+#if USE_PAWN_HASH == 1
+    PawnHashEntry pawnTable[PAWN_HASH_ENTRIES];
+
+    // to compute hit rate of the pawn hash table
+    uint64 pawnHashProbes;
+    uint64 pawnHashHits;
+#endif
+
+#if USE_EVAL_CACHE == 1
+    // to compute hit rate of the eval cache
+    uint64 evalCacheProbes;
+    uint64 evalCacheHits;
+#endif
+
+    // no. of nodes/moves pruned by each static eval based pruning technique
+#if USE_FUTILITY_PRUNING == 1
+    uint64 futilityPrunes;
+#endif
+#if USE_REVERSE_FUTILITY_PRUNING == 1
+    uint64 reverseFutilityPrunes;
+#endif
+#if USE_RAZORING == 1
+    uint64 razorPrunes;
+#endif
+
+#if USE_LATE_MOVE_REDUCTION == 1
+    // no. of moves searched with reduced depth and the ones that needed a re-search
+    uint64 lmrReductions;
+    uint64 lmrResearches;
 #endif
 
+#if USE_LAZY_EVAL == 1
+    // no. of evals that could use lazy eval, and the ones that exited early
+    uint64 lazyEvalProbes;
+    uint64 lazyEvalExits;
+#endif
+
+#if USE_DELTA_PRUNING == 1
+    // no. of q-search nodes searched, and the q-search moves skipped by delta pruning
+    uint64 qNodes;
+    uint64 deltaPrunes;
+#endif
+
+#if GATHER_STATS == 1
+    uint32 totalSearched;
+    uint32 nonTTSearched;
+    uint32 nonCaptureSearched;
+    uint32 nonKillersSearched;
+#endif
+};
+
+// all classes contain mostly static functions and static member variables
+class Game
+{
+private:
+    // the current board position
+    static HexaBitBoardPosition pos;
+
+    // time to search for (in ms)
+    static int searchTime;
+
+    // max time limit (in ms)
+    // the search must be aborted if we exceed this
+    static int searchTimeLimit;
+
+    static int maxSearchDepth;
+
+    // hashes of positions in the game so far (to detect repetitions)
+    // plyNo is relative to the position provided in "position" uci command
+    static uint64 gameHashes[MAX_GAME_LENGTH];
+    static int    plyNo;
+
     // a ref count of ir-reversible moves (*not* incremented during search)
     // only incremented as the game progresses (when a move is actually made)
     // used for transposition table ageing
     static uint8  irreversibleMoveRefCount;
 
-    static uint64 nodes;
-
-#if GATHER_STATS == 1
-    static uint32 totalSearched;
-    static uint32 nonTTSearched;
-    static uint32 nonCaptureSearched;
-    static uint32 nonKillersSearched;
-#endif
+    // no of threads used for search (main thread + helper threads)
+    static int numThreads;
 
-    // killer moves
-    static CMove killers[MAX_GAME_LENGTH][MAX_KILLERS];
+    // per thread search state (searchThreads[0] is used by the main search thread)
+    static SearchContext *searchThreads[MAX_SEARCH_THREADS];
 
     // the code assumes that there are only two killer moves
     CT_ASSERT(MAX_KILLERS == 2);
 
+    // the move picker uses the move ordering functions below
+    template<uint8 chance> friend class MovePicker;
+
+    // allocate (cache line aligned) and clear search context for the given thread
+    static SearchContext *AllocContext(int threadId);
+
     // sort captures based on SEE
+    // returns the no. of captures with SEE score >= minScore (by default only the winning captures)
     template<uint8 chance>
-    static int16 SortCapturesSEE(HexaBitBoardPosition *pos, CMove* captures, int nMoves);
+    static int16 SortCapturesSEE(HexaBitBoardPosition *pos, CMove* captures, int nMoves, int16 minScore = 1);
+
+    // score of a quiet move based on history heuristic (used for move ordering)
+    static float GetHistoryScore(SearchContext *ctx, HexaBitBoardPosition *pos, CMove move, uint8 chance);
+
+    static void UpdateHistory(SearchContext *ctx, HexaBitBoardPosition *pos, CMove move, int depth, uint8 chance, bool betaCutoff);
+
+
+    // check (every STOP_CHECK_INTERVAL nodes) if we have exceeded the time limit, returns true if the search needs to be aborted
+    static bool checkStop(SearchContext *ctx);
 
-    // sort moves on history heuristic
-    static void SortMovesHistory(HexaBitBoardPosition *pos, CMove *moves, int nMoves, uint8 chance);
+    // static evaluation of the given position (looked up from eval cache when possible)
+    // if lazy eval is enabled, the returned score can be inexact when it's far outside the [alpha, beta] window
+    static int16 staticEval(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int16 alpha = -INF, int16 beta = INF);
 
-    static void UpdateHistory(HexaBitBoardPosition *pos, CMove move, int depth, uint8 chance, bool betaCutoff);
+    // lazy eval settings
+    static bool  lazyEval;
+    static int16 lazyEvalMargin;
 
+    // delta pruning settings (for q-search)
+    static bool  deltaPruning;
+    static int16 deltaPruningMargin;
 
     // perform alpha-beta search on the given position
+    // ctx is the state of the search thread calling the function
     template<uint8 chance>
-    static int16 alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int ply, int16 alpha, int16 beta, bool tryNullMove, CMove lastMove);
+    static int16 alphabeta(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int ply, int16 alpha, int16 beta, bool tryNullMove, CMove lastMove);
 
+    // late move reductions (in plies) indexed by [isPVNode][depth][moveNumber]
+    static uint8 lmrTable[2][LMR_TABLE_DEPTH][LMR_TABLE_MOVES];
+    static void  initLMRTable();
+    static bool  lateMoveReductions;
+
+    // no of plies to reduce a late quiet move (historyScore is the move's score from GetHistoryScore)
+    static int   getLMRReduction(int depth, bool isPVNode, int movesSearched, float historyScore);
+
+    // runtime toggles for static eval based pruning
+    static bool  futilityPruning;
+    static bool  reverseFutilityPruning;
+    static bool  razoring;
+
+    // search a child node (using PVS)
     template<uint8 chance>
-    static int16 alphabetaRoot(HexaBitBoardPosition *pos, int depth, int ply);
+    static int16 searchMove(SearchContext *ctx, HexaBitBoardPosition *newPos, uint64 newHash, const EvalState &newEvalState, int depth, int curPly, int16 alpha, int16 beta, bool firstMove, CMove move);
+
+    template<uint8 chance>
+    static int16 alphabetaRoot(SearchContext *ctx, HexaBitBoardPosition *pos, int depth, int ply, int16 alpha, int16 beta);
+
+    // one iteration of iterative deepening (using aspiration window around prevScore)
+    static int16 searchRoot(SearchContext *ctx, HexaBitBoardPosition *pos, int depth, int ply, int16 prevScore);
 
 
     // perform q-search
     template<uint8 chance>
-    static int16 q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 alpha, int16 beta, int curPly);
+    static int16 q_search(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int16 alpha, int16 beta, int curPly);
+
+    // entry point for helper threads of lazy SMP search
+    // runs it's own iterative deepening loop (with staggered depths) till stopped by main thread
+    static void HelperThreadMain(SearchContext *ctx);
 
     static uint64 perft(HexaBitBoardPosition *pos, int depth);
 
+    // expand the tree till the given depth and store the leaf positions (used for splitting work of parallel perft)
+    static void perftSplit(HexaBitBoardPosition *pos, int depth, HexaBitBoardPosition *leaves, int *nLeaves);
+
+    // entry point for parallel perft threads
+    // keeps picking positions from the shared work queue till it's empty
+    static void PerftThreadMain(int threadId, HexaBitBoardPosition *positions, int nPositions, int depth, bool hashed,
+                                std::atomic<int> *nextPosition, uint64 *threadNodes, int *threadPositions, uint64 *threadTime);
+
+    // perft using the perft TT to avoid searching transpositions again
+    static uint64 perft_hashed(HexaBitBoardPosition *pos, uint64 hash, int depth);
+
     // for testing
     template<uint8 chance>
     static uint64 perft_test(HexaBitBoardPosition *pos, int depth);
 public:
     // set hash for a previous board position (also update ply no)
-    static void SetHashForPly(int ply, uint64 hash)                  { posHashes[ply] = hash; assert(ply >= plyNo); plyNo = ply; }
+    static void SetHashForPly(int ply, uint64 hash)                  { gameHashes[ply] = hash; assert(ply >= plyNo); plyNo = ply; }
 
     static void     SetIrReversibleRefCount(int counter)             { irreversibleMoveRefCount = (uint8)counter; printf("\nrefcount: %d\n", counter);  }
     static uint8    GetIrReversibleRefCount()                        { return irreversibleMoveRefCount; }
@@ -542,15 +803,41 @@ public:
 
     static void SetMaxDepth(int depth)                               { maxSearchDepth = depth; }
 
+    // enable/disable LMR (e.g, for A/B testing)
+    static void SetLateMoveReductions(bool enable)                   { lateMoveReductions = enable; }
+
+    // enable/disable static eval based pruning techniques (for testing)
+    static void SetFutilityPruning(bool enable)                      { futilityPruning = enable; }
+    static void SetReverseFutilityPruning(bool enable)               { reverseFutilityPruning = enable; }
+    static void SetRazoring(bool enable)                             { razoring = enable; }
+
+    // enable/disable lazy eval (e.g, for eval tuning) and set it's margin
+    static void SetLazyEval(bool enable)                             { lazyEval = enable; }
+    static void SetLazyEvalMargin(int margin)                        { lazyEvalMargin = (int16) margin; }
+
+    // enable/disable delta pruning in q-search and set it's safety margin
+    static void SetDeltaPruning(bool enable)                         { deltaPruning = enable; }
+    static void SetDeltaPruningMargin(int margin)                    { deltaPruningMargin = (int16) margin; }
+
+    // set no of threads to use for search
+    static void SetNumThreads(int threads);
+    static int  GetNumThreads()                                      { return numThreads; }
+
     // start search (called from a different thread)
     // returns when we run out of time (or if terminiated from main thread)
     static void StartSearch();
 
+    // ask all search threads to stop (called from a different thread)
+    static void StopSearch();
+
     // compute the PV from transposition table
-    static void GetPVFromTT(HexaBitBoardPosition *pos);
+    static void GetPVFromTT(SearchContext *ctx, HexaBitBoardPosition *pos);
+
+    // total nodes searched by all threads (in the last or ongoing search)
+    static uint64 GetNodeCount();
 
     // get the best move resulting from the last (or ongoing) search
-    static CMove GetBestMove()                                      { return bestMove; }
+    static CMove GetBestMove()                                      { return searchThreads[0]->bestMove; }
 
     // this is set to true when the worker thread is active and searching the game tree
     static volatile bool searching;
@@ -558,6 +845,16 @@ public:
     // util routine to verify move generation
     // computes perft of the current position till the given depth
     static uint64 Perft(int depth);
+
+    // fast perft of the given position (bulk counting, no hashing)
+    static uint64 Perft(HexaBitBoardPosition *pos, int depth)       { return perft(pos, depth); }
+
+    // multi-threaded perft
+    // the tree is split at splitPly and the positions at that ply are searched by a pool of threads
+    // nodes counted, no. of split positions processed and the time taken (in micro-seconds) by each thread are
+    // returned in threadNodes, threadPositions and threadTime
+    // hashed: use the (shared) perft TT
+    static uint64 ParallelPerft(int depth, int nThreads, int splitPly, bool hashed, uint64 *threadNodes, int *threadPositions, uint64 *threadTime);
 };
 
 struct FancyMagicEntry
@@ -714,19 +1011,72 @@ struct DualTTEntry
 };
 CT_ASSERT(sizeof(DualTTEntry) == 24);
 
-// size of q-search TT, (2 MB)
+// one slot of the lockless TT
+// hash key is stored xor-ed with the data so that a slot that is partially over-written
+// by another thread (key from one write and data from another) doesn't match the hash anymore
+struct LocklessTTSlot
+{
+    uint64 key;     // hash ^ data
+
+    union
+    {
+        uint64 data;
+        struct
+        {
+            uint16 bestMove;    // 16 bits
+            int16  score;       // 16 bits
+            uint8  scoreType;   // 8 bits
+            uint8  depth;       // 8 bits
+            uint8  age;         // 8 bits
+            uint8  free;        // 8 bits
+        };
+    };
+};
+CT_ASSERT(sizeof(LocklessTTSlot) == 16);
+
+// two slots per entry (deepest and most recent) like DualTTEntry
+struct LocklessTTEntry
+{
+    LocklessTTSlot deepest;
+    LocklessTTSlot mostRecent;
+};
+CT_ASSERT(sizeof(LocklessTTEntry) == 32);
+
+// entry of the perft TT (stores perft count of a position at a given depth)
+// key is xor-ed with the count like LocklessTTSlot so that the table can be shared between perft threads
+struct PerftTTEntry
+{
+    uint64 key;     // (hash ^ zob.depth[depth]) ^ count
+    uint64 count;
+};
+CT_ASSERT(sizeof(PerftTTEntry) == 16);
+
+// default size of perft TT (128 MB)
+#define DEFAULT_PERFT_TT_SIZE (128*1024*1024)
+
+// default (and min) size of q-search TT, (2 MB)
 #define Q_TT_SIZE_BITS  18
 #define Q_TT_ELEMENTS   (1 << Q_TT_SIZE_BITS)
-#define Q_TT_INDEX_BITS (Q_TT_ELEMENTS - 1)
-#define Q_TT_HASH_BITS  (0xFFFFFFFFFFFFFFFFull ^ Q_TT_INDEX_BITS)
+#define DEFAULT_Q_TT_SIZE (Q_TT_ELEMENTS * sizeof(uint64))
 
 // index bits should be large enough to hold score and score type (score type is 2 bits)
-CT_ASSERT(Q_TT_SIZE_BITS >= sizeof(int16) + 2);
+CT_ASSERT(Q_TT_SIZE_BITS >= 16 + 2);
+
+// default (and min) size of eval cache (8 MB and 512 KB)
+// every entry is a single 64 bit word: 48 MSBs of hash key and 16 bit score
+#define EVAL_CACHE_MIN_ELEMENTS (1 << 16)
+#define DEFAULT_EVAL_CACHE_SIZE (8 * 1024 * 1024)
+
+// min no. of entries in the main TT
+// (the non-lockless entries re-use the 16 LSBs of hash key for storing best move)
+#define MIN_TT_ELEMENTS (1 << 16)
 
 class TranspositionTable
 {
 private:
-#if USE_DUAL_SLOT_TT == 1
+#if USE_DUAL_SLOT_TT == 1 && USE_LOCKLESS_TT == 1
+    static LocklessTTEntry *TT;
+#elif USE_DUAL_SLOT_TT == 1
     static DualTTEntry *TT;
 #else
     static TTEntry *TT;        // the transposition table
@@ -736,16 +1086,78 @@ private:
     static uint64  hashBits;   // ALLSET ^ indexBits;
 
     static uint64  *qTT;       // a small TT dedicated for q-search
+    static uint64  qIndexBits; // qSize-1
+    static uint64  qHashBits;  // ALLSET ^ qIndexBits
+
+    static uint64  *evalCache;     // cache of static evaluation scores
+    static uint64  evalIndexBits;  // evalCacheSize-1
+
+    // requested sizes (in bytes)
+    static uint64  byteSize;
+    static uint64  qByteSize;
+    static uint64  evalByteSize;
+
+    // type of pages obtained for the tables (PAGE_MODE_*)
+    static uint8   pageMode;
+    static uint8   qPageMode;
+    static uint8   evalPageMode;
+
+    // TT used by hashed perft (allocated only when needed)
+    static PerftTTEntry *perftTT;
+    static uint64  perftIndexBits;
+    static uint64  perftByteSize;
+    static uint8   perftPageMode;
+
+#if USE_LOCKLESS_TT == 1
+    // read a slot of lockless TT (returns false if the slot doesn't belong to the given hash or is torn)
+    static bool    readSlot(const LocklessTTSlot *slot, uint64 hash, LocklessTTSlot *out);
+    static void    writeSlot(LocklessTTSlot *slot, uint64 hash, const LocklessTTSlot &in);
+#endif
 public:
-    static void  init(int byteSize = DEAFULT_TT_SIZE);
+    // allocate the tables (of the last set size)
+    // no. of entries is rounded down to a power of two
+    static void  init();
     static void  destroy();
     static void  reset();
 
+    // set size (in bytes) of the main and q-search TT
+    // the table is re-allocated (and cleared) if it was already allocated
+    static void  setSize(uint64 bytes);
+    static void  setQSize(uint64 bytes);
+    static void  setEvalCacheSize(uint64 bytes);
+
+    static bool  isAllocated()                                       { return TT != NULL; }
+
+    // actual size (in bytes) of the allocated tables
+    static uint64 getSize()                                          { return size * sizeof(*TT); }
+    static uint64 getQSize()                                         { return (qIndexBits + 1) * sizeof(uint64); }
+    static uint64 getEvalCacheSize()                                 { return (evalIndexBits + 1) * sizeof(uint64); }
+
+    // type of pages used for the tables
+    static uint8  getPageMode()                                      { return pageMode; }
+    static uint8  getQPageMode()                                     { return qPageMode; }
+    static uint8  getEvalCachePageMode()                             { return evalPageMode; }
+
     static bool  lookup(uint64 hash, int searchDepth, int16 *score, uint8 *scoreType, int *foundDepth, CMove *bestMove);
     static void  update(uint64 hash, int16 score, uint8 scoreType, CMove bestMove, int depth, int age);
 
     static bool  lookup_q(uint64 hash, int16 *eval, uint8 *type);
     static void  update_q(uint64 hash, int16  eval, uint8  type);
+
+    // eval cache (stores static evaluation of positions from point of view of side to move)
+    static bool  lookup_eval(uint64 hash, int16 *eval);
+    static void  update_eval(uint64 hash, int16  eval);
+
+    // perft TT
+    // the size is set (in bytes) using setPerftSize, and the table is allocated on first use by initPerft
+    static void  initPerft();
+    static void  setPerftSize(uint64 bytes);
+    static bool  isPerftAllocated()                                  { return perftTT != NULL; }
+    static uint64 getPerftSize()                                     { return (perftIndexBits + 1) * sizeof(PerftTTEntry); }
+    static uint8  getPerftPageMode()                                 { return perftPageMode; }
+
+    static bool  lookup_perft(uint64 hash, int depth, uint64 *count);
+    static void  update_perft(uint64 hash, int depth, uint64  count);
 };
 
 class BitBoardUtils
@@ -782,7 +1194,8 @@ private:
     static uint64 RookAttacksMasked[64];
     static uint64 BishopAttacksMasked[64];
 
-    static uint64   rookMagicAttackTables[64][1 << ROOK_MAGIC_BITS  ];  // 2 MB
+    static uint64 (*rookMagicAttackTables)[1 << ROOK_MAGIC_BITS];       // 2 MB (allocated in init using large pages)
+    static uint8    rookMagicPageMode;
     static uint64 bishopMagicAttackTables[64][1 << BISHOP_MAGIC_BITS];  // 256 KB
 
     // fancy magic lookup tables
@@ -795,6 +1208,35 @@ private:
     static uint64 fancy_byte_RookLookup[4900];          // 39 K
     static uint64 fancy_byte_BishopLookup[1428];        // 11 K
 
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    // PEXT lookup tables: the occupancy bits under the mask are extracted (_pext_u64) to directly index the table
+    #define PEXT_ROOK_TABLE_SIZE   102400
+    #define PEXT_BISHOP_TABLE_SIZE 5248
+    static uint64 pextRookAttackTable[PEXT_ROOK_TABLE_SIZE];        // 800 KB
+    static uint64 pextBishopAttackTable[PEXT_BISHOP_TABLE_SIZE];    //  41 KB
+    static uint32 pextRookOffset[64];
+    static uint32 pextBishopOffset[64];
+
+    // the backend used by bishopAttacks/rookAttacks (one of SLIDING_ATTACKS_*)
+    static uint8  slidingAttackMode;
+
+    // fill the PEXT lookup tables
+    static void initPextTables();
+
+    // use the pext instruction (must be called only if the CPU supports BMI2)
+    TARGET_BMI2 static uint64 pextBishopAttacks(uint8 sq, uint64 occ);
+    TARGET_BMI2 static uint64 pextRookAttacks(uint8 sq, uint64 occ);
+
+    // pick the fastest backend for the CPU we are running on (using CPUID)
+    static uint8 detectSlidingAttackMode();
+
+    // the SIMD path used by findAttackedSquares and findPinnedPieces (one of SIMD_ATTACKS_*)
+    static uint8  simdAttackMode;
+
+    // best SIMD path supported by the CPU (and the OS)
+    static uint8 detectSimdAttackSupport();
+#endif
+
 
     // lookup table helper functions
     static uint64 sqsInBetweenLUT(uint8 sq1, uint8 sq2);
@@ -954,15 +1396,37 @@ private:
     // core functions
     static int16 getPieceSquareScore(uint64 pieceSet, uint64 whiteSet, const int16 table[]);
 
+    // material value and piece-square score of each piece (indexed by color, piece and square) for incremental eval
+    // values are signed from white's point of view
+    // piece-square scores are packed middle/end game scores
+    static int16 pieceMaterial[2][8];
+    static int32 pieceSquareScore[2][8][64];
+    static int16 piecePhase[8];
+    static void  initEvalTables();
+
+    // compute material, piece-square and phase parts of eval state from scratch
+    static void  computeMaterialAndPST(HexaBitBoardPosition *pos, EvalState *evalState);
+
+    // check the incrementally updated eval state against the one computed from scratch
+    static bool  verifyEvalState(HexaBitBoardPosition *pos, const EvalState &evalState);
+
     // evaluate mobility
-    static int16 evaluateMobility(const EvalBitBoard &ebb, bool endGame);
+    // (returns packed middle/end game score)
+    static int32 evaluateMobility(const EvalBitBoard &ebb);
 
     // evaluate pawn structure
-    static int16 evaluatePawnStructure(const EvalBitBoard &ebb, bool endGame);
+    static int32 evaluatePawnStructure(const EvalBitBoard &ebb);
+    static int32 pawnStructureScore(const PawnHashEntry &entry);
+    static void  computePawnStructure(const EvalBitBoard &ebb, PawnHashEntry *entry);
+
+    // evaluate a board position (from the side to move's point of view)
+    // pawn hash table of ctx is used if it's not NULL
+    static int16 evaluate(HexaBitBoardPosition *pos, SearchContext *ctx, const EvalState *evalState);
 
 public:
+    // evalState (if not NULL) is also updated incrementally
     template<uint8 chance>
-    static void makeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move);
+    static void makeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move, EvalState *evalState = NULL);
 
     template<uint8 chance>
     static int generateBoards(HexaBitBoardPosition *pos, HexaBitBoardPosition *newPositions);
@@ -987,11 +1451,24 @@ public:
     template<uint8 chance>
     static int generateMovesCausingCheck(const ExpandedBitBoard *bb, CMove *genMoves);
 
+    // check if the move could have been generated by the move generators in the given position
+    // pins and checks are ignored, i.e, the move might still leave the king in check
+    // first step of isLegalMove (used to validate TT and killer moves without generating all the moves)
+    template<uint8 chance>
+    static bool isPseudoLegalMove(const ExpandedBitBoard *bb, CMove move);
+
+    // check if the move is legal (pseudo-legal check + pins and checks using the pinned and threatened masks)
+    template<uint8 chance>
+    static bool isLegalMove(const ExpandedBitBoard *bb, CMove move);
+
     static int getPieceAtSquare(HexaBitBoardPosition *pos, uint64 square);
 
     template<uint8 chance>
     static int16 seeSquare(HexaBitBoardPosition *pos, uint64 square);
 
+    // pieces of both sides attacking the square, considering only the pieces in 'occupied'
+    static uint64 attackersToSquare(HexaBitBoardPosition *pos, uint64 square, uint64 occupied);
+
 public:
     // unpack the bitboard structure
     template<uint8 chance>
@@ -999,6 +1476,9 @@ public:
 
     static bool IsInCheck(HexaBitBoardPosition *pos);
 
+    // if the pawns of the given side can capture en-passent (the en-passent target is part of the hash key only then)
+    static bool IsEnPassentPossible(HexaBitBoardPosition *pos, uint8 chance);
+
     // count the no of child moves possible at given board position
     static int CountMoves(HexaBitBoardPosition *pos);
 
@@ -1008,20 +1488,58 @@ public:
     // generate child boards for the given board position
     static int GenerateBoards(HexaBitBoardPosition *pos, HexaBitBoardPosition *newPositions);
 
+#if USE_BATCHED_MOVE_COUNT == 1
+    // generate child boards in structure-of-arrays layout
+    static int GenerateBoards(HexaBitBoardPosition *pos, HexaBitBoardBatch *batch);
+
+    // count the no of child moves of all positions in the batch (all of them must have the given side to move)
+    // 4 (AVX2) or 8 (AVX-512) positions are processed at once depending on the SIMD attack mode.
+    // returns the sum, the individual counts are also stored in counts (if it's not NULL)
+    static uint64 CountMovesBatch(const HexaBitBoardBatch *batch, int nPositions, uint8 chance, uint32 *counts);
+#endif
+
     // generate only captures - in MVV-LVA order
     static int GenerateCaptures(HexaBitBoardPosition *pos, CMove *genMoves);
     static int GenerateNonCaptures(HexaBitBoardPosition *pos, CMove *genMoves);
 
+    // check if the given move (e.g, obtained from TT or killer table) is legal in the given position
+    // fast enough to be called per node (doesn't generate moves, or make the move)
+    static bool IsLegalMove(HexaBitBoardPosition *pos, CMove move);
+
     // make the given move in the given board position
     static void MakeMove(HexaBitBoardPosition *pos, uint64 &hash, CMove move);
+    static void MakeMove(HexaBitBoardPosition *pos, uint64 &hash, EvalState &evalState, CMove move);
+
+    // compute the incrementally updated eval state from scratch
+    static void ComputeEvalState(HexaBitBoardPosition *pos, EvalState *evalState);
+    static uint64 ComputePawnHash(HexaBitBoardPosition *pos);
 
     // evaluate a board position
     static int16 Evaluate(HexaBitBoardPosition *pos);
 
+    // same as above, but uses the per-thread pawn hash table and the incrementally updated material and piece-square scores
+    static int16 Evaluate(HexaBitBoardPosition *pos, SearchContext *ctx, const EvalState &evalState);
+
+    // partial evaluation using only the material and piece-square scores from evalState
+    // returns true (and the partial score in eval) if the partial score is outside [alpha, beta] by more than margin
+    // i.e, mobility and pawn structure terms are unlikely to bring it back inside the window
+    static bool  EvaluateLazy(HexaBitBoardPosition *pos, const EvalState &evalState, int16 alpha, int16 beta, int16 margin, int16 *eval);
+
     // evaluate a capture using SEE
     template<uint8 chance>
     static int16 EvaluateSEE(HexaBitBoardPosition *pos, CMove capture);
 
+    // faster version of the above using a swap list on attack bitboards (without making any moves)
+    // pins are ignored
+    template<uint8 chance>
+    static int16 EvaluateSEEFast(HexaBitBoardPosition *pos, CMove capture);
+
+    // material gained by making the move (captured piece and promotion)
+    static int16 MaterialGain(HexaBitBoardPosition *pos, CMove move);
+
+    // verify EvaluateSEEFast against EvaluateSEE on the captures of the given positions and time both
+    static void BenchmarkSEE(HexaBitBoardPosition *positions, int nPositions, int iterations);
+
     // evaluate if the position is a draw
     static bool isDrawn(ExpandedBitBoard const &bb);
 
@@ -1032,4 +1550,99 @@ public:
     static bool IsIrReversibleMove(HexaBitBoardPosition *pos, CMove move);
 
     static void init();
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    // backend used for sliding piece attacks (selected at init based on CPU features)
+    // returns false if the given mode isn't supported by the CPU
+    static bool  SetSlidingAttackMode(uint8 mode);
+    static uint8 GetSlidingAttackMode()                              { return slidingAttackMode; }
+
+    // the mode that init selects for this CPU
+    static uint8 GetDefaultSlidingAttackMode()                       { return detectSlidingAttackMode(); }
+    static const char *SlidingAttackModeName(uint8 mode);
+
+    // SIMD (kogge-stone) path for computing attacked squares and pinned pieces
+    // returns false if the given mode isn't supported by the CPU
+    static bool  SetSimdAttackMode(uint8 mode);
+    static uint8 GetSimdAttackMode()                                 { return simdAttackMode; }
+
+    // AVX2 when available (AVX-512 isn't enabled by default as it can lower clock speeds on some CPUs)
+    static uint8 GetDefaultSimdAttackMode()                          { return detectSimdAttackSupport() >= SIMD_ATTACKS_AVX2 ? SIMD_ATTACKS_AVX2 : SIMD_ATTACKS_NONE; }
+    static const char *SimdAttackModeName(uint8 mode);
+
+    // time the sliding attack/pin computations using magics and all the supported SIMD paths
+    // (also verifies that all of them produce the same results)
+    static void BenchmarkSimdAttacks(HexaBitBoardPosition *positions, int nPositions, int iterations);
+#endif
+
+    // type of pages used for the rook magic attack table
+    static uint8 GetMagicTablePageMode()                             { return rookMagicPageMode; }
+};
+
+// stages of the move picker (in the order they are tried)
+enum eMovePickerStage
+{
+    MP_TT_MOVE = 0,
+    MP_GEN_CAPTURES,
+    MP_GOOD_CAPTURES,
+    MP_KILLERS,
+    MP_GEN_QUIETS,
+    MP_QUIETS,
+    MP_BAD_CAPTURES,
+    MP_GEN_EVASIONS,
+    MP_EVASIONS,
+    MP_DONE
+};
+
+// hands out the moves of a node to alphabeta one at a time, in the order they should be searched:
+// TT move, winning captures (and promotions), killers, quiet moves (best history score first) and losing captures.
+// moves of a stage are generated only when the previous stages are exhausted, so a node that gets a
+// beta cutoff from the TT move, a capture or a killer never pays for generating (and sorting) quiet moves.
+// when in check, all evasions are generated together after trying the TT move.
+template<uint8 chance>
+class MovePicker
+{
+private:
+    SearchContext          *ctx;
+    HexaBitBoardPosition   *pos;
+    const ExpandedBitBoard *bb;
+    int                     depth;
+    bool                    inCheck;
+
+    // the stage we are in, and the stage of the move returned last
+    int   stage;
+    int   moveStage;
+
+    // TT move and killers (validated before being handed out)
+    CMove ttMove;
+    CMove killers[MAX_KILLERS];
+
+    // captures are stored in [0, nCaptures) - with winning captures in [0, nGoodCaptures)
+    // quiet moves (or evasions) are stored in [nCaptures, nMoves)
+    CMove moves[MAX_MOVES];
+    float scores[MAX_MOVES];
+    int   nMoves;
+    int   nCaptures;
+    int   nGoodCaptures;
+
+    // next move to try in the current stage
+    int   current;
+
+    // if the quiet moves/evasions need to be picked in order of scores
+    bool  sortMoves;
+
+    // compute ordering scores of quiet moves (or evasions) in [nCaptures, nMoves)
+    void  scoreMoves();
+
+    // return the remaining quiet move (or evasion) with best score (selection sort on demand)
+    CMove pickBest();
+
+public:
+    MovePicker(SearchContext *ctx, HexaBitBoardPosition *pos, const ExpandedBitBoard *bb, CMove ttMove, int depth, bool inCheck);
+
+    // returns the next move to search (or an invalid move when there are no more moves)
+    CMove nextMove();
+
+    // the stage the move last returned by nextMove() belongs to
+    int   getStage()                                                 { return moveStage; }
 };
@@ -221,6 +221,7 @@ int16 BitBoardUtils::getPieceSquareScore(uint64 pieceSet, uint64 whiteSet, const
 }
 
 
+
 // we use different mobility multipliers for each piece and have a non-linear scale to encourage uniform development of pieces
 // good explanation can be found here: http://www.madchess.net/post/madchess-2-0-beta-build-29
 
@@ -245,39 +246,88 @@ const int16 rookEgMobility[] =   {-50, -22, -11, -2, 6, 12, 18, 24, 29, 34, 38,
 const int16 queenMgMobility[] =  {-10, -6, -5, -4, -2, -2, -1, 0, 1, 2, 2, 3, 3, 4, 4, 5, 6, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 10}; // (4 * x Pow 0.5) - 10};
 const int16 queenEgMobility[] =  {-50, -30, -22, -16, -10, -6, -2, 2, 6, 10, 13, 16, 19, 22, 24, 27, 30, 32, 34, 37, 39, 41, 43, 45, 47, 50, 51, 53}; // (20 * x Pow 0.5) - 50};
 
-int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
+int16 BitBoardUtils::pieceMaterial[2][8];
+int32 BitBoardUtils::pieceSquareScore[2][8][64];
+int16 BitBoardUtils::piecePhase[8];
+
+// packed middle/end game mobility scores (indexed by no. of moves), initialized by initEvalTables
+static int32 knightMobilityScore[9];
+static int32 bishopMobilityScore[14];
+static int32 rookMobilityScore[15];
+static int32 queenMobilityScore[28];
+
+void BitBoardUtils::initEvalTables()
 {
-// use madchess values
-#if 1
-    const int16 *knightMobilityFactor;
-    const int16 *bishopMobilityFactor;
-    const int16 *rookMobilityFactor;
-    const int16 *queenMobilityFactor;
+    const int16 *mgTables[] = { NULL, squareEvalPawnMid, squareEvalKnight, squareEvalBishop, squareEvalRook, squareEvalQueen, squareEvalKingMid };
+    const int16 *egTables[] = { NULL, squareEvalPawnEnd, squareEvalKnight, squareEvalBishop, squareEvalRook, squareEvalQueen, squareEvalKingEnd };
+    const int16 phases[]    = { 0, 0, 1, 1, 2, 4, 0 };
+
+    memset(pieceMaterial, 0, sizeof(pieceMaterial));
+    memset(pieceSquareScore, 0, sizeof(pieceSquareScore));
+    memset(piecePhase, 0, sizeof(piecePhase));
+
+    for (int piece = PAWN; piece <= KING; piece++)
+    {
+        if (piece != KING)
+        {
+            pieceMaterial[WHITE][piece] =  materialEval[piece];
+            pieceMaterial[BLACK][piece] = -materialEval[piece];
+        }
+        piecePhase[piece] = phases[piece];
+
+        // same indexing as getPieceSquareScore
+        for (int sq = 0; sq < 64; sq++)
+        {
+            pieceSquareScore[WHITE][piece][sq] =  MAKE_SCORE(mgTables[piece][sq + 64], egTables[piece][sq + 64]);
+            pieceSquareScore[BLACK][piece][sq] = -MAKE_SCORE(mgTables[piece][sq], egTables[piece][sq]);
+        }
+    }
 
     // THIS IS NOT A BUG
     // accidently found that the mobility values (from Madchess) when reversed work better
     // This might be because giving too much weight to mobility makes the engine lose pawns in the end game (and/or discourage promotion)
-    if (endGame)
-    {
-        knightMobilityFactor = knightMgMobility;
-        bishopMobilityFactor = bishopMgMobility;
-        rookMobilityFactor   = rookMgMobility;
-        queenMobilityFactor  = queenMgMobility;
-    }
-    else
+    for (int i = 0; i < 9; i++)
+        knightMobilityScore[i] = MAKE_SCORE(knightEgMobility[i], knightMgMobility[i]);
+    for (int i = 0; i < 14; i++)
+        bishopMobilityScore[i] = MAKE_SCORE(bishopEgMobility[i], bishopMgMobility[i]);
+    for (int i = 0; i < 15; i++)
+        rookMobilityScore[i] = MAKE_SCORE(rookEgMobility[i], rookMgMobility[i]);
+    for (int i = 0; i < 28; i++)
+        queenMobilityScore[i] = MAKE_SCORE(queenEgMobility[i], queenMgMobility[i]);
+}
+
+void BitBoardUtils::computeMaterialAndPST(HexaBitBoardPosition *pos, EvalState *evalState)
+{
+    int16 material = 0, phase = 0;
+    int32 psq = 0;
+
+    uint64 allPieces = pos->kings | (pos->pawns & RANKS2TO7) | pos->knights | pos->bishopQueens | pos->rookQueens;
+    while (allPieces)
     {
-        knightMobilityFactor = knightEgMobility;
-        bishopMobilityFactor = bishopEgMobility;
-        rookMobilityFactor   = rookEgMobility;
-        queenMobilityFactor  = queenEgMobility;
+        uint64 piece = getOne(allPieces);
+        int color = !(piece & pos->whitePieces);
+        int type = getPieceAtSquare(pos, piece);
+        int sq = bitScan(piece);
+
+        material += pieceMaterial[color][type];
+        psq += pieceSquareScore[color][type][sq];
+        phase += piecePhase[type];
+
+        allPieces ^= piece;
     }
-#endif
+
+    evalState->material = material;
+    evalState->psq = psq;
+    evalState->phase = phase;
+}
 
 
+int32 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb)
+{
     // these are not strictly valid moves (ignores pinned piece checking, etc)
     // TODO: also try with exact move counts ?
 
-    int16 mobility = 0;
+    int32 mobility = 0;
     // 1. pawn moves
 #if 0
     uint64 whitePawns = ebb.whitePawns;
@@ -319,7 +369,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
     {
         uint64 knight = getOne(whiteKnights);
         uint64 knightMoves = sqKnightAttacks(bitScan(knight)) & ~ebb.whitePieces;
-        mobility += knightMobilityFactor[popCount(knightMoves)];
+        mobility += knightMobilityScore[popCount(knightMoves)];
         whiteKnights ^= knight;
     }
 
@@ -328,7 +378,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
     {
         uint64 knight = getOne(blackKnights);
         uint64 knightMoves = sqKnightAttacks(bitScan(knight)) & ~ebb.blackPieces;
-        mobility -= knightMobilityFactor[popCount(knightMoves)];
+        mobility -= knightMobilityScore[popCount(knightMoves)];
         blackKnights ^= knight;
     }
 
@@ -338,7 +388,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
     {
         uint64 bishop = getOne(whiteBishops);
         uint64 bishopMoves = bishopAttacks(bishop, ~ebb.allPieces) & ~ebb.whitePieces;
-        mobility += bishopMobilityFactor[popCount(bishopMoves)];
+        mobility += bishopMobilityScore[popCount(bishopMoves)];
         whiteBishops ^= bishop;
     }
 
@@ -347,7 +397,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
     {
         uint64 bishop = getOne(blackBishops);
         uint64 bishopMoves = bishopAttacks(bishop, ~ebb.allPieces) & ~ebb.blackPieces;
-        mobility -= bishopMobilityFactor[popCount(bishopMoves)];
+        mobility -= bishopMobilityScore[popCount(bishopMoves)];
         blackBishops ^= bishop;
     }
 
@@ -357,7 +407,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
     {
         uint64 rook = getOne(whiteRooks);
         uint64 rookMoves = rookAttacks(rook, ~ebb.allPieces) & ~ebb.whitePieces;
-        mobility += rookMobilityFactor[popCount(rookMoves)];
+        mobility += rookMobilityScore[popCount(rookMoves)];
         whiteRooks ^= rook;
     }
 
@@ -366,7 +416,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
     {
         uint64 rook = getOne(blackRooks);
         uint64 rookMoves = rookAttacks(rook, ~ebb.allPieces) & ~ebb.blackPieces;
-        mobility -= rookMobilityFactor[popCount(rookMoves)];
+        mobility -= rookMobilityScore[popCount(rookMoves)];
         blackRooks ^= rook;
     }
 
@@ -377,7 +427,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
         uint64 queen = getOne(whiteQueens);
         uint64 queenMoves = bishopAttacks(queen, ~ebb.allPieces) & ~ebb.whitePieces;
         queenMoves |= rookAttacks(queen, ~ebb.allPieces) & ~ebb.whitePieces;
-        mobility += queenMobilityFactor[popCount(queenMoves)];
+        mobility += queenMobilityScore[popCount(queenMoves)];
         whiteQueens ^= queen;
     }
 
@@ -387,7 +437,7 @@ int16 BitBoardUtils::evaluateMobility(const EvalBitBoard &ebb, bool endGame)
         uint64 queen = getOne(blackQueens);
         uint64 queenMoves = bishopAttacks(queen, ~ebb.allPieces) & ~ebb.blackPieces;
         queenMoves |= rookAttacks(queen, ~ebb.allPieces) & ~ebb.blackPieces;
-        mobility -= queenMobilityFactor[popCount(queenMoves)];
+        mobility -= queenMobilityScore[popCount(queenMoves)];
         blackQueens ^= queen;
     }
 
@@ -451,7 +501,7 @@ const int16 passedPawnBonusWhite[] =
       0,  0,  0,  0,  0,  0,  0,  0,
 };
 
-int16 BitBoardUtils::evaluatePawnStructure(const EvalBitBoard &ebb, bool endGame)
+void BitBoardUtils::computePawnStructure(const EvalBitBoard &ebb, PawnHashEntry *entry)
 {
     int16 score = 0;
 
@@ -472,6 +522,7 @@ int16 BitBoardUtils::evaluatePawnStructure(const EvalBitBoard &ebb, bool endGame
         uint64 allFrontSpansBlack = westOne(blackFrontSpan) | blackFrontSpan | eastOne(blackFrontSpan);
         uint64 whitePassedPawns = ebb.whitePawns & (~allFrontSpansBlack);
         whitePassedPawns &= ~whitePawnsInfrontOwn;     // no double bonus for doubled pawn
+        entry->passedPawns[WHITE] = whitePassedPawns;
         while (whitePassedPawns)
         {
             uint64 pawn = getOne(whitePassedPawns);
@@ -487,6 +538,7 @@ int16 BitBoardUtils::evaluatePawnStructure(const EvalBitBoard &ebb, bool endGame
         uint64 allFrontSpansWhite = westOne(whiteFrontSpan) | whiteFrontSpan | eastOne(whiteFrontSpan);
         uint64 blackPassedPawns = ebb.blackPawns & (~allFrontSpansWhite);
         blackPassedPawns &= ~blackPawnsInfrontOwn;     // no double bonus for doubled pawn
+        entry->passedPawns[BLACK] = blackPassedPawns;
         while (blackPassedPawns)
         {
             uint64 pawn = getOne(blackPassedPawns);
@@ -499,18 +551,76 @@ int16 BitBoardUtils::evaluatePawnStructure(const EvalBitBoard &ebb, bool endGame
             blackPassedPawns ^= pawn;
         }
     }
-    if (!endGame)
+
+    entry->score = score;
+    entry->passedPawnScore = passedPawnScore;
+}
+
+// passed pawns get only half the bonus in middle game
+int32 BitBoardUtils::pawnStructureScore(const PawnHashEntry &entry)
+{
+    return MAKE_SCORE(entry.score + entry.passedPawnScore / 2, entry.score + entry.passedPawnScore);
+}
+
+int32 BitBoardUtils::evaluatePawnStructure(const EvalBitBoard &ebb)
+{
+    PawnHashEntry entry;
+    computePawnStructure(ebb, &entry);
+
+    return pawnStructureScore(entry);
+}
+
+
+int16 BitBoardUtils::Evaluate(HexaBitBoardPosition *pos)
+{
+    return evaluate(pos, NULL, NULL);
+}
+
+int16 BitBoardUtils::Evaluate(HexaBitBoardPosition *pos, SearchContext *ctx, const EvalState &evalState)
+{
+#if VERIFY_EVAL_STATE == 1
+    assert(verifyEvalState(pos, evalState));
+#endif
+    return evaluate(pos, ctx, &evalState);
+}
+
+bool BitBoardUtils::EvaluateLazy(HexaBitBoardPosition *pos, const EvalState &evalState, int16 alpha, int16 beta, int16 margin, int16 *eval)
+{
+    uint64 allPieces = pos->kings | (pos->pawns & RANKS2TO7) | pos->knights | pos->bishopQueens | pos->rookQueens;
+    uint64 whitePieces = pos->whitePieces;
+    uint64 blackPieces = allPieces ^ whitePieces;
+
+    // full eval is needed to detect basic draws (king and a minor piece vs anything)
+    if (popCount(whitePieces) <= 2 || popCount(blackPieces) <= 2)
+        return false;
+
+    uint64 allBishops = pos->bishopQueens & ~pos->rookQueens;
+    int16 material = evalState.material;
+    if (popCount(allBishops & whitePieces) == 2)
+        material += BISHOP_PAIR_VAL;
+    if (popCount(allBishops & blackPieces) == 2)
+        material -= BISHOP_PAIR_VAL;
+
+    int phase = evalState.phase;
+    if (phase > MAX_PHASE)
+        phase = MAX_PHASE;
+    int16 partial = material + (MG_SCORE(evalState.psq) * phase + EG_SCORE(evalState.psq) * (MAX_PHASE - phase)) / MAX_PHASE;
+
+    if (pos->chance == BLACK)
+        partial = -partial;
+
+    if (partial - margin >= beta || partial + margin <= alpha)
     {
-        passedPawnScore /= 2;
+        *eval = partial;
+        return true;
     }
-    score += passedPawnScore;
-    return score;
-}
 
+    return false;
+}
 
 // call templated version (on chance) of the function internally?
 //  - not really required as we always evaluate from white's prespective and then invert he score if needed
-int16 BitBoardUtils::Evaluate(HexaBitBoardPosition *pos)
+int16 BitBoardUtils::evaluate(HexaBitBoardPosition *pos, SearchContext *ctx, const EvalState *evalState)
 {
     uint64 allPawns = pos->pawns & RANKS2TO7;    // get rid of game state variables
 
@@ -539,15 +649,16 @@ int16 BitBoardUtils::Evaluate(HexaBitBoardPosition *pos)
     ebb.blackBishops = allBishops  & ebb.blackPieces;
     ebb.blackKing    = pos->kings  & ebb.blackPieces;
 
-    // material eval
-    int16 material = 0;
-
-    material += (popCount(ebb.whiteQueens)  - popCount(ebb.blackQueens))  * QUEEN_MATERIAL_VAL;
-    material += (popCount(ebb.whiteRooks)   - popCount(ebb.blackRooks))   * ROOK_MATERIAL_VAL;
-    material += (popCount(ebb.whiteBishops) - popCount(ebb.blackBishops)) * BISHOP_MATERIAL_VAL;
-    material += (popCount(ebb.whiteKnights) - popCount(ebb.blackKnights)) * KNIGHT_MATERIAL_VAL;
-    material += (popCount(ebb.whitePawns)   - popCount(ebb.blackPawns))   * PAWN_MATERIAL_VAL;
+    // material and piece-square scores are updated incrementally by makeMove
+    EvalState scratch;
+    if (!evalState)
+    {
+        computeMaterialAndPST(pos, &scratch);
+        evalState = &scratch;
+    }
 
+    // material eval
+    int16 material = evalState->material;
 
     if (popCount(ebb.whiteBishops) == 2)
         material += BISHOP_PAIR_VAL;
@@ -555,35 +666,11 @@ int16 BitBoardUtils::Evaluate(HexaBitBoardPosition *pos)
         material -= BISHOP_PAIR_VAL;
 
     // positional eval (using piece square tables)
-    // maybe use two tables - for white and black pieces?
-    int16 positional = 0;
-
-    positional += getPieceSquareScore(allKnights, ebb.whitePieces, squareEvalKnight);
-    positional += getPieceSquareScore(allBishops, ebb.whitePieces, squareEvalBishop);
-    positional += getPieceSquareScore(allRooks,   ebb.whitePieces, squareEvalRook);
-    positional += getPieceSquareScore(allQueens,  ebb.whitePieces, squareEvalQueen);
-
-    bool endGame = false;
-    uint64 whiteValPieces = ebb.whiteRooks | ebb.whiteBishops | ebb.whiteKnights;
-    uint64 blackValPieces = ebb.blackRooks | ebb.blackBishops | ebb.blackKnights;
-    if ((allQueens == 0) || (whiteValPieces == 0) || (blackValPieces == 0))
-    {
-        endGame = true;
-    }
-
-    if (endGame)
-    {
-        positional += getPieceSquareScore(allPawns, ebb.whitePieces, squareEvalPawnEnd);
-        positional += getPieceSquareScore(pos->kings, ebb.whitePieces, squareEvalKingEnd);
-    }
-    else
-    {
-        positional += getPieceSquareScore(allPawns, ebb.whitePieces, squareEvalPawnMid);
-        positional += getPieceSquareScore(pos->kings, ebb.whitePieces, squareEvalKingMid);
-    }
+    // all positional terms are packed middle/end game scores
+    int32 positional = evalState->psq;
 
     // mobility eval
-    int16 mobility = evaluateMobility(ebb, endGame);
+    positional += evaluateMobility(ebb);
 
     // just counting valid moves seems to work better than the above :-/
     //int whiteMoves = countMoves<WHITE>(pos);
@@ -593,10 +680,36 @@ int16 BitBoardUtils::Evaluate(HexaBitBoardPosition *pos)
     
     
     // pawn structure
-    int16 pawnStruct = evaluatePawnStructure(ebb, endGame);
-    
+#if USE_PAWN_HASH == 1
+    if (ctx)
+    {
+        PawnHashEntry *entry = &ctx->pawnTable[evalState->pawnHash & (PAWN_HASH_ENTRIES - 1)];
+        ctx->pawnHashProbes++;
+        if (entry->pawnHash == evalState->pawnHash)
+        {
+            ctx->pawnHashHits++;
+        }
+        else
+        {
+            computePawnStructure(ebb, entry);
+            entry->pawnHash = evalState->pawnHash;
+        }
+
+        positional += pawnStructureScore(*entry);
+    }
+    else
+#endif
+    {
+        positional += evaluatePawnStructure(ebb);
+    }
+
+    // interpolate between middle game and end game scores based on game phase
+    int phase = evalState->phase;
+    if (phase > MAX_PHASE)
+        phase = MAX_PHASE;
+    int16 tapered = (MG_SCORE(positional) * phase + EG_SCORE(positional) * (MAX_PHASE - phase)) / MAX_PHASE;
     
-    int16 finalEval = material + positional + mobility + pawnStruct;
+    int16 finalEval = material + tapered;
 
     // evaluate basic draws
     if ((popCount(ebb.whitePieces) == 2) && (finalEval > 0))
@@ -764,8 +877,216 @@ int16 BitBoardUtils::EvaluateSEE(HexaBitBoardPosition *origpos, CMove capture)
 }
 
 
+// material gained by the move: value of the captured piece + value gained by promoting the pawn (if any)
+int16 BitBoardUtils::MaterialGain(HexaBitBoardPosition *pos, CMove move)
+{
+    uint8 flags = move.getFlags();
+    if (flags == CM_FLAG_EP_CAPTURE)
+        return PAWN_MATERIAL_VAL;
+
+    int16 gain = materialEval[getPieceAtSquare(pos, BIT(move.getTo()))];
+    if (flags & CM_FLAG_PROMOTION)
+    {
+        gain += materialEval[(flags & 0x3) + KNIGHT] - PAWN_MATERIAL_VAL;
+    }
+
+    return gain;
+}
+
+// pieces of both sides attacking the given square (only the pieces in 'occupied' are considered)
+// sliding attacks are computed using 'occupied' so that removing a piece uncovers the x-ray attackers behind it
+uint64 BitBoardUtils::attackersToSquare(HexaBitBoardPosition *pos, uint64 square, uint64 occupied)
+{
+    uint8 sqIndex = bitScan(square);
+    uint64 allPawns = pos->pawns & RANKS2TO7;
+
+    uint64 whitePawns = (southWestOne(square) | southEastOne(square)) & allPawns & pos->whitePieces;
+    uint64 blackPawns = (northWestOne(square) | northEastOne(square)) & allPawns & (~pos->whitePieces);
+
+    uint64 attackers = whitePawns | blackPawns |
+                       (sqKnightAttacks(sqIndex) & pos->knights) |
+                       (sqKingAttacks(sqIndex) & pos->kings) |
+                       (bishopAttacks(square, ~occupied) & pos->bishopQueens) |
+                       (rookAttacks(square, ~occupied) & pos->rookQueens);
+
+    return attackers & occupied;
+}
+
+// same as EvaluateSEE but uses a swap list instead of making the moves
+// the attackers of the square are found only once and x-ray attackers are added as pieces are removed from the occupancy
+// unlike EvaluateSEE, pinned pieces are allowed to take part in the exchange
+template<uint8 chance>
+int16 BitBoardUtils::EvaluateSEEFast(HexaBitBoardPosition *pos, CMove capture)
+{
+    uint64 src    = BIT(capture.getFrom());
+    uint64 square = BIT(capture.getTo());
+
+    uint64 allPawns    = pos->pawns & RANKS2TO7;
+    uint64 occupied    = pos->kings | allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
+    uint64 whitePieces = pos->whitePieces;
+    uint64 blackPieces = occupied & (~whitePieces);
+
+    uint64 allQueens = pos->bishopQueens & pos->rookQueens;
+    uint64 bishops   = pos->bishopQueens & (~allQueens);
+    uint64 rooks     = pos->rookQueens & (~allQueens);
+
+    // value of the piece captured by each move of the exchange
+    int16 swapList[32];
+    int   nSwaps = 0;
+
+    int16 capturedVal = materialEval[getPieceAtSquare(pos, square)];
+
+    // value of the piece that would be captured by the next recapture
+    int16 pieceVal = materialEval[getPieceAtSquare(pos, src)];
+
+    if (capture.getFlags() & CM_FLAG_PROMOTION)
+    {
+        pieceVal = materialEval[(capture.getFlags() & 0x3) + KNIGHT];
+        capturedVal += pieceVal;
+    }
+    else if (capture.getFlags() == CM_FLAG_EP_CAPTURE)
+    {
+        capturedVal = PAWN_MATERIAL_VAL;
+        occupied ^= (chance == WHITE) ? southOne(square) : northOne(square);
+    }
+
+    swapList[nSwaps++] = capturedVal;
+    occupied ^= src;
+
+    uint64 attackers = attackersToSquare(pos, square, occupied);
+    uint8  color = !chance;
+
+    while (1)
+    {
+        uint64 sidePieces = (color == WHITE) ? whitePieces : blackPieces;
+        uint64 sideAttackers = attackers & sidePieces;
+        if (!sideAttackers)
+            break;
+
+        // least valuable attacker
+        uint64 attacker;
+        int piece;
+        if      ((attacker = sideAttackers & allPawns))     piece = PAWN;
+        else if ((attacker = sideAttackers & pos->knights)) piece = KNIGHT;
+        else if ((attacker = sideAttackers & bishops))      piece = BISHOP;
+        else if ((attacker = sideAttackers & rooks))        piece = ROOK;
+        else if ((attacker = sideAttackers & allQueens))    piece = QUEEN;
+        else
+        {
+            // king can't capture pieces that have support (the king itself doesn't block x-ray attackers)
+            attacker = sideAttackers & pos->kings;
+            uint64 enemyPieces = (color == WHITE) ? blackPieces : whitePieces;
+            if (attackersToSquare(pos, square, occupied ^ attacker) & enemyPieces)
+                break;
+            piece = KING;
+        }
+        attacker = getOne(attacker);
+
+        swapList[nSwaps++] = pieceVal;
+        pieceVal = materialEval[piece];
+
+        // pawns recapturing on the last rank get promoted to queen (promotion value added the same way as for the first capture)
+        if (piece == PAWN && (square & (RANK1 | RANK8)))
+        {
+            swapList[nSwaps - 1] += QUEEN_MATERIAL_VAL;
+            pieceVal = QUEEN_MATERIAL_VAL;
+        }
+        occupied ^= attacker;
+
+        // add x-ray attackers uncovered by the capturing piece
+        if (piece == PAWN || piece == BISHOP || piece == QUEEN)
+            attackers |= bishopAttacks(square, ~occupied) & pos->bishopQueens;
+        if (piece == ROOK || piece == QUEEN)
+            attackers |= rookAttacks(square, ~occupied) & pos->rookQueens;
+        attackers &= occupied;
+
+        color = !color;
+    }
+
+    // each side can choose to stop capturing (same as the recursion in seeSquare)
+    int16 score = 0;
+    while (--nSwaps)
+    {
+        score = swapList[nSwaps] - score;
+        if (score < 0)
+            score = 0;
+    }
+
+    return swapList[0] - score;
+}
+
+// compare EvaluateSEEFast against EvaluateSEE for all the captures in the given positions, and time both of them
+void BitBoardUtils::BenchmarkSEE(HexaBitBoardPosition *positions, int nPositions, int iterations)
+{
+    // captures (as generated by q-search) of all the positions that are not in check
+    CMove *captures = (CMove *) malloc(sizeof(CMove) * nPositions * MAX_MOVES);
+    int   *posIndex = (int *) malloc(sizeof(int) * nPositions * MAX_MOVES);
+    int nCaptures = 0;
+    for (int i = 0; i < nPositions; i++)
+    {
+        HexaBitBoardPosition *pos = &positions[i];
+        ExpandedBitBoard bb = (pos->chance == WHITE) ? ExpandBitBoard<WHITE>(pos) : ExpandBitBoard<BLACK>(pos);
+        if (bb.threatened & bb.myKing)
+            continue;
+
+        int n = (pos->chance == WHITE) ? generateCaptures<WHITE>(&bb, &captures[nCaptures]) : generateCaptures<BLACK>(&bb, &captures[nCaptures]);
+        for (int j = 0; j < n; j++)
+            posIndex[nCaptures + j] = i;
+        nCaptures += n;
+    }
+
+    // 1. verify
+    // a few mismatches are expected as the fast version ignores pins (and EvaluateSEE doesn't promote pawns recapturing on the last rank)
+    int exactMatches = 0, pruneMatches = 0, orderMatches = 0;
+    for (int i = 0; i < nCaptures; i++)
+    {
+        HexaBitBoardPosition *pos = &positions[posIndex[i]];
+        int16 ref  = (pos->chance == WHITE) ? EvaluateSEE<WHITE>(pos, captures[i])     : EvaluateSEE<BLACK>(pos, captures[i]);
+        int16 fast = (pos->chance == WHITE) ? EvaluateSEEFast<WHITE>(pos, captures[i]) : EvaluateSEEFast<BLACK>(pos, captures[i]);
+
+        exactMatches += (ref == fast);
+        pruneMatches += ((ref < 0) == (fast < 0));      // losing captures are pruned from q-search
+        orderMatches += ((ref > 0) == (fast > 0));      // winning captures are searched first
+    }
+
+    // 2. time both versions
+    double time[2];
+    int16 check[2];
+    for (int version = 0; version < 2; version++)
+    {
+        int16 sum = 0;
+        Timer timer;
+        timer.start();
+        for (int it = 0; it < iterations; it++)
+        {
+            for (int i = 0; i < nCaptures; i++)
+            {
+                HexaBitBoardPosition *pos = &positions[posIndex[i]];
+                if (version == 0)
+                    sum += (pos->chance == WHITE) ? EvaluateSEE<WHITE>(pos, captures[i]) : EvaluateSEE<BLACK>(pos, captures[i]);
+                else
+                    sum += (pos->chance == WHITE) ? EvaluateSEEFast<WHITE>(pos, captures[i]) : EvaluateSEEFast<BLACK>(pos, captures[i]);
+            }
+        }
+        time[version] = (double) timer.getElapsedMicroSeconds();
+        check[version] = sum;
+    }
+
+    double calls = (double) nCaptures * iterations;
+    printf("%d captures in %d positions x %d iterations\n", nCaptures, nPositions, iterations);
+    printf("same score: %.2f%%, same losing/non-losing: %.2f%%, same winning/non-winning: %.2f%%\n",
+           exactMatches * 100.0 / nCaptures, pruneMatches * 100.0 / nCaptures, orderMatches * 100.0 / nCaptures);
+    printf("EvaluateSEE: %6.2f ns, EvaluateSEEFast: %6.2f ns per capture (checksums %d, %d)\n",
+           time[0] * 1000 / calls, time[1] * 1000 / calls, check[0], check[1]);
+
+    free(posIndex);
+    free(captures);
+}
+
 template int16 BitBoardUtils::EvaluateSEE<WHITE>(HexaBitBoardPosition *origpos, CMove capture);
 template int16 BitBoardUtils::EvaluateSEE<BLACK>(HexaBitBoardPosition *origpos, CMove capture);
 
 template int16 BitBoardUtils::seeSquare<BLACK>(HexaBitBoardPosition *pos, uint64 square);
-template int16 BitBoardUtils::seeSquare<WHITE>(HexaBitBoardPosition *pos, uint64 square);
\ No newline at end of file
+template int16 BitBoardUtils::seeSquare<WHITE>(HexaBitBoardPosition *pos, uint64 square);
+template int16 BitBoardUtils::EvaluateSEEFast<WHITE>(HexaBitBoardPosition *pos, CMove capture);
+template int16 BitBoardUtils::EvaluateSEEFast<BLACK>(HexaBitBoardPosition *pos, CMove capture);
@@ -150,6 +150,14 @@ uint8  BitBoardUtils::fancy_byte_magic_lookup_table[97264];  // 95 KB
 uint64 BitBoardUtils::fancy_byte_RookLookup[4900];           // 39 K
 uint64 BitBoardUtils::fancy_byte_BishopLookup[1428];         // 11 K
 
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+// PEXT lookup tables (no magic multiply needed: index is the occupancy bits under the mask packed together)
+uint64 BitBoardUtils::pextRookAttackTable[PEXT_ROOK_TABLE_SIZE];        // 800 KB
+uint64 BitBoardUtils::pextBishopAttackTable[PEXT_BISHOP_TABLE_SIZE];    //  41 KB
+uint32 BitBoardUtils::pextRookOffset[64];
+uint32 BitBoardUtils::pextBishopOffset[64];
+#endif
+
 
 
 
@@ -296,6 +304,40 @@ uint64 BitBoardUtils::findBishopMagicForSquare(int square, uint64 magicAttackTab
     return findMagicCommon(occCombos, attacks, magicAttackTable, numCombos, BISHOP_MAGIC_BITS, preCalculatedMagic, uniqueAttackTable, byteIndices, numUniqueAttacks);
 }
 
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+// getOccCombo(mask, i) deposits the bits of i into the set bits of mask (lowest first)
+// which is exactly the inverse of _pext_u64(occ, mask), so the i'th combo goes to the i'th entry of the square's table
+void BitBoardUtils::initPextTables()
+{
+    uint32 rookOffset = 0, bishopOffset = 0;
+    for (int square = A1; square <= H8; square++)
+    {
+        uint64 thisSquare = BIT(square);
+
+        pextRookOffset[square] = rookOffset;
+        int numCombos = 1 << popCount(RookAttacksMasked[square]);
+        for (int i = 0; i < numCombos; i++)
+        {
+            uint64 occ = getOccCombo(RookAttacksMasked[square], i);
+            pextRookAttackTable[rookOffset + i] = rookAttacksKoggeStone(thisSquare, ~occ);
+        }
+        rookOffset += numCombos;
+
+        pextBishopOffset[square] = bishopOffset;
+        numCombos = 1 << popCount(BishopAttacksMasked[square]);
+        for (int i = 0; i < numCombos; i++)
+        {
+            uint64 occ = getOccCombo(BishopAttacksMasked[square], i);
+            pextBishopAttackTable[bishopOffset + i] = bishopAttacksKoggeStone(thisSquare, ~occ);
+        }
+        bishopOffset += numCombos;
+    }
+
+    assert(rookOffset == PEXT_ROOK_TABLE_SIZE);
+    assert(bishopOffset == PEXT_BISHOP_TABLE_SIZE);
+}
+#endif
+
 // only for testing
 #if 0
 uint64 rookMagicAttackTables[64][1 << ROOK_MAGIC_BITS];
@@ -1,4 +1,6 @@
 #include "chess.h"
+#include <new>
+#include <xmmintrin.h>
 
 int main()
 {
@@ -18,54 +20,61 @@ int Game::searchTimeLimit;
 
 int Game::maxSearchDepth;
 
-CMove Game::bestMove;
-CMove Game::pv[MAX_GAME_LENGTH];
-int   Game::pvLen;
-
-uint64 Game::nodes;
-
-#if GATHER_STATS == 1
-uint32 Game::totalSearched;
-uint32 Game::nonTTSearched;
-uint32 Game::nonCaptureSearched;
-uint32 Game::nonKillersSearched;
-#endif
-
-
-uint64 Game::posHashes[MAX_GAME_LENGTH];
+uint64 Game::gameHashes[MAX_GAME_LENGTH];
 int Game::plyNo;
 uint8 Game::irreversibleMoveRefCount;
 
-CMove Game::killers[MAX_GAME_LENGTH][MAX_KILLERS];
+int            Game::numThreads = 1;
+SearchContext *Game::searchThreads[MAX_SEARCH_THREADS];
 
-#if HISTORY_PER_PIECE == 1
-uint32 Game::historyScore[2][6][64][64];
-uint32 Game::butterflyScore[2][6][64][64];
-#else
-uint32 Game::historyScore[2][64][64];
-uint32 Game::butterflyScore[2][64][64];
-#endif
+volatile bool Game::searching;
 
-Timer Game::timer;
+bool  Game::lazyEval = true;
+int16 Game::lazyEvalMargin = DEFAULT_LAZY_EVAL_MARGIN;
 
+bool  Game::deltaPruning = true;
+int16 Game::deltaPruningMargin = DEFAULT_DELTA_PRUNING_MARGIN;
 
-volatile bool Game::searching;
+SearchContext *Game::AllocContext(int threadId)
+{
+    if (searchThreads[threadId] == NULL)
+    {
+        searchThreads[threadId] = (SearchContext *) _mm_malloc(sizeof(SearchContext), 64);
+    }
+    else
+    {
+        searchThreads[threadId]->~SearchContext();
+    }
+
+    // value-initialization clears all the fields
+    // (memset can't be used as the context has non-trivial members like std::atomic)
+    SearchContext *ctx = new (searchThreads[threadId]) SearchContext();
+    ctx->threadId = threadId;
+    return ctx;
+}
 
 void Game::Reset()
 {
     // initialize variables, etc
     memset(&pos, 0, sizeof(pos));
-    memset(&bestMove, 0, sizeof(bestMove));
-    memset(posHashes, 0, sizeof(posHashes));
-    memset(killers, 0, sizeof(killers));
-    memset(historyScore, 0, sizeof(historyScore));
-    memset(butterflyScore, 0, sizeof(butterflyScore));
+    memset(gameHashes, 0, sizeof(gameHashes));
+
+    // clear killers, history, etc of all the threads used so far
+    for (int i = 0; i < MAX_SEARCH_THREADS; i++)
+    {
+        if (searchThreads[i] || i == 0)
+            AllocContext(i);
+    }
 
     searchTime = 0;
     searchTimeLimit = 0;
     maxSearchDepth = MAX_SEARCH_LENGTH;
     plyNo = 0;
     irreversibleMoveRefCount = 0;
+
+#if USE_LATE_MOVE_REDUCTION == 1
+    initLMRTable();
+#endif
 }
 
 void Game::SetTimeControls(int wtime, int btime, int movestogo, int winc, int binc, int searchTimeExact)
@@ -109,40 +118,158 @@ void Game::SetTimeControls(int wtime, int btime, int movestogo, int winc, int bi
     }
 }
 
+void Game::SetNumThreads(int threads)
+{
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_SEARCH_THREADS)
+        threads = MAX_SEARCH_THREADS;
+
+    numThreads = threads;
+}
+
+void Game::StopSearch()
+{
+    for (int i = 0; i < numThreads; i++)
+    {
+        if (searchThreads[i])
+            searchThreads[i]->stop = true;
+    }
+}
+
+uint64 Game::GetNodeCount()
+{
+    uint64 total = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        total += searchThreads[i]->nodes;
+    }
+    return total;
+}
+
+// helper threads skip some of the iterations so that not all threads search the same depth at the same time
+// (same skip pattern as used by stockfish's lazy SMP implementation)
+static const int helperSkipSize[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+static const int helperSkipPhase[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+#define HELPER_SKIP_TABLE_SIZE (sizeof(helperSkipSize) / sizeof(helperSkipSize[0]))
+
+void Game::HelperThreadMain(SearchContext *ctx)
+{
+    // each helper thread works on it's own copy of the root position
+    HexaBitBoardPosition rootPos = pos;
+
+    int skipIndex = (ctx->threadId - 1) % HELPER_SKIP_TABLE_SIZE;
+
+    int16 eval = 0;
+    for (int depth = 1; depth < maxSearchDepth && !ctx->stop; depth++)
+    {
+        if (((depth + helperSkipPhase[skipIndex]) / helperSkipSize[skipIndex]) % 2)
+            continue;
+
+        eval = searchRoot(ctx, &rootPos, depth, plyNo + 1, eval);
+    }
+}
+
 void Game::StartSearch()
 {
     searching = true;
-    nodes = 0;
+
+    // set up per thread search state
+    // killers and history tables are retained from the previous search (cleared only on new game)
+    for (int i = 0; i < numThreads; i++)
+    {
+        if (searchThreads[i] == NULL)
+            AllocContext(i);
+
+        SearchContext *ctx = searchThreads[i];
+        ctx->stop = false;
+        ctx->nodes = 0;
+        ctx->nodesSinceStopCheck = 0;
+        ctx->bestMove = CMove(0);
+        ctx->searchTime = searchTime;
+        ctx->searchTimeLimit = searchTimeLimit;
+        ctx->pvLen = 0;
+        memcpy(ctx->posHashes, gameHashes, sizeof(gameHashes));
+
+#if USE_PAWN_HASH == 1
+        // the pawn hash table itself is retained
+        ctx->pawnHashProbes = 0;
+        ctx->pawnHashHits = 0;
+#endif
+
+#if USE_EVAL_CACHE == 1
+        ctx->evalCacheProbes = 0;
+        ctx->evalCacheHits = 0;
+#endif
+
+#if USE_FUTILITY_PRUNING == 1
+        ctx->futilityPrunes = 0;
+#endif
+#if USE_REVERSE_FUTILITY_PRUNING == 1
+        ctx->reverseFutilityPrunes = 0;
+#endif
+#if USE_RAZORING == 1
+        ctx->razorPrunes = 0;
+#endif
+
+#if USE_LATE_MOVE_REDUCTION == 1
+        ctx->lmrReductions = 0;
+        ctx->lmrResearches = 0;
+#endif
+
+#if USE_LAZY_EVAL == 1
+        ctx->lazyEvalProbes = 0;
+        ctx->lazyEvalExits = 0;
+#endif
+
+#if USE_DELTA_PRUNING == 1
+        ctx->qNodes = 0;
+        ctx->deltaPrunes = 0;
+#endif
 
 #if GATHER_STATS == 1
-    totalSearched = 0;
-    nonTTSearched = 0;
-    nonCaptureSearched = 0;
-    nonKillersSearched = 0;
+        ctx->totalSearched = 0;
+        ctx->nonTTSearched = 0;
+        ctx->nonCaptureSearched = 0;
+        ctx->nonKillersSearched = 0;
 #endif
+        ctx->timer.start();
+    }
 
-    timer.start();
+    SearchContext *mainCtx = searchThreads[0];
+
+    // in case the search is stopped even before the first iteration could search a single move
+    CMove rootMoves[MAX_MOVES];
+    if (BitBoardUtils::GenerateMoves(&pos, rootMoves))
+    {
+        mainCtx->bestMove = rootMoves[0];
+    }
+
+    // launch helper threads (lazy SMP)
+    // they search the same position and communicate with the main thread only via the shared TT
+    std::thread *helpers[MAX_SEARCH_THREADS];
+    for (int i = 1; i < numThreads; i++)
+    {
+        helpers[i] = new std::thread(HelperThreadMain, searchThreads[i]);
+    }
 
+    int16 eval = 0;
     for (int depth = 1; depth < maxSearchDepth; depth++)
     {
+        eval = searchRoot(mainCtx, &pos, depth, plyNo + 1, eval);
 
-        int16 eval = 0;
-        try
-        {
-            if (pos.chance == WHITE)
-                eval = alphabetaRoot<WHITE>(&pos, depth, plyNo + 1);
-            else
-                eval = alphabetaRoot<BLACK>(&pos, depth, plyNo + 1);
-        }
-        catch (std::exception exp)
+        // aborted (stopped or out of time) in the middle of the iteration, its score is not usable
+        // (best move of the completed part is already recorded)
+        if (mainCtx->stop)
         {
             break;
         }
 
-        GetPVFromTT(&pos);
+        GetPVFromTT(mainCtx, &pos);
 
-        uint64 timeElapsed = timer.stop();
-        uint64 nps = nodes * 1000;
+        uint64 timeElapsed = mainCtx->timer.stop();
+        uint64 totalNodes = GetNodeCount();
+        uint64 nps = totalNodes * 1000;
         if (timeElapsed)
         {
             nps /= timeElapsed;    // time is in ms
@@ -168,33 +295,132 @@ void Game::StartSearch()
             // mateDepth is in plies -> convert it into moves
             mateDepth /= 2;
 
-            printf("info depth %d score mate %d nodes %llu time %llu nps %llu pv ", depth, mateDepth, nodes, timeElapsed, nps);
+            printf("info depth %d score mate %d nodes %llu time %llu nps %llu pv ", depth, mateDepth, totalNodes, timeElapsed, nps);
         }
         else
         {
-            printf("info depth %d score cp %d nodes %llu time %llu nps %llu pv ", depth, (int)eval, nodes, timeElapsed, nps);
+            printf("info depth %d score cp %d nodes %llu time %llu nps %llu pv ", depth, (int)eval, totalNodes, timeElapsed, nps);
         }
 
         // display the PV (TODO: currently the PV is wrong after second move)
-        for (int i = 0; i < pvLen; i++)
+        for (int i = 0; i < mainCtx->pvLen; i++)
         {
-            Utils::displayCompactMove(pv[i]);
+            Utils::displayCompactMove(mainCtx->pv[i]);
         }
         printf("\n");
 
 #if GATHER_STATS == 1
-        printf("total: %d, needsMoveGen: %d, needsNonCaptures: %d, needsNonKillers: %d\n", totalSearched, nonTTSearched, nonCaptureSearched, nonKillersSearched);
+        printf("total: %d, needsMoveGen: %d, needsNonCaptures: %d, needsNonKillers: %d\n", mainCtx->totalSearched, mainCtx->nonTTSearched, mainCtx->nonCaptureSearched, mainCtx->nonKillersSearched);
 #endif
 
         fflush(stdout);
 
         // TODO: better time management
-        if (foundMate || (timeElapsed > (searchTime / 1.3f)))
+        if (foundMate || (timeElapsed > (mainCtx->searchTime / 1.3f)))
         {
             break;
         }
     }
 
+    // stop the helper threads and wait for them to finish
+    StopSearch();
+    for (int i = 1; i < numThreads; i++)
+    {
+        helpers[i]->join();
+        delete helpers[i];
+    }
+
+#if USE_PAWN_HASH == 1
+    uint64 pawnHashProbes = 0, pawnHashHits = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        pawnHashProbes += searchThreads[i]->pawnHashProbes;
+        pawnHashHits += searchThreads[i]->pawnHashHits;
+    }
+    printf("info string pawn hash hits %llu of %llu probes (%.1f%%)\n", pawnHashHits, pawnHashProbes,
+           pawnHashProbes ? 100.0 * pawnHashHits / pawnHashProbes : 0.0);
+    fflush(stdout);
+#endif
+
+#if USE_EVAL_CACHE == 1
+    uint64 evalCacheProbes = 0, evalCacheHits = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        evalCacheProbes += searchThreads[i]->evalCacheProbes;
+        evalCacheHits += searchThreads[i]->evalCacheHits;
+    }
+    printf("info string eval cache hits %llu of %llu probes (%.1f%%)\n", evalCacheHits, evalCacheProbes,
+           evalCacheProbes ? 100.0 * evalCacheHits / evalCacheProbes : 0.0);
+    fflush(stdout);
+#endif
+
+#if USE_FUTILITY_PRUNING == 1
+    uint64 futilityPrunes = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        futilityPrunes += searchThreads[i]->futilityPrunes;
+    }
+    printf("info string futility pruned %llu moves\n", futilityPrunes);
+    fflush(stdout);
+#endif
+
+#if USE_REVERSE_FUTILITY_PRUNING == 1
+    uint64 reverseFutilityPrunes = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        reverseFutilityPrunes += searchThreads[i]->reverseFutilityPrunes;
+    }
+    printf("info string reverse futility pruned %llu nodes\n", reverseFutilityPrunes);
+    fflush(stdout);
+#endif
+
+#if USE_RAZORING == 1
+    uint64 razorPrunes = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        razorPrunes += searchThreads[i]->razorPrunes;
+    }
+    printf("info string razored %llu nodes\n", razorPrunes);
+    fflush(stdout);
+#endif
+
+#if USE_LATE_MOVE_REDUCTION == 1
+    uint64 lmrReductions = 0, lmrResearches = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        lmrReductions += searchThreads[i]->lmrReductions;
+        lmrResearches += searchThreads[i]->lmrResearches;
+    }
+    printf("info string late move reductions %llu, re-searched %llu (%.1f%%)\n", lmrReductions, lmrResearches,
+           lmrReductions ? 100.0 * lmrResearches / lmrReductions : 0.0);
+    fflush(stdout);
+#endif
+
+#if USE_LAZY_EVAL == 1
+    uint64 lazyEvalProbes = 0, lazyEvalExits = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        lazyEvalProbes += searchThreads[i]->lazyEvalProbes;
+        lazyEvalExits += searchThreads[i]->lazyEvalExits;
+    }
+    printf("info string lazy eval exits %llu of %llu evals (%.1f%%)\n", lazyEvalExits, lazyEvalProbes,
+           lazyEvalProbes ? 100.0 * lazyEvalExits / lazyEvalProbes : 0.0);
+    fflush(stdout);
+#endif
+
+#if USE_DELTA_PRUNING == 1
+    // every pruned move is a q-search node that wasn't searched
+    uint64 deltaPrunes = 0, qNodes = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        deltaPrunes += searchThreads[i]->deltaPrunes;
+        qNodes += searchThreads[i]->qNodes;
+    }
+    printf("info string delta pruned %llu of %llu q-search nodes (%.1f%%)\n", deltaPrunes, qNodes + deltaPrunes,
+           (qNodes + deltaPrunes) ? 100.0 * deltaPrunes / (qNodes + deltaPrunes) : 0.0);
+    fflush(stdout);
+#endif
+
     searching = false;
 }
 
@@ -214,6 +440,16 @@ uint64 Game::perft(HexaBitBoardPosition *pos, int depth)
         return (uint64) nMoves;
     }
 
+#if USE_BATCHED_MOVE_COUNT == 1
+    if (depth == 2 && BitBoardUtils::GetSimdAttackMode() != SIMD_ATTACKS_NONE)
+    {
+        // optimization 3: bulk count moves of several children at once using SIMD
+        HexaBitBoardBatch batch;
+        nMoves = BitBoardUtils::GenerateBoards(pos, &batch);
+        return BitBoardUtils::CountMovesBatch(&batch, nMoves, !pos->chance, NULL);
+    }
+#endif
+
     // optimization 2: directly generate boards instead of first generating moves and then boards
     nMoves = BitBoardUtils::GenerateBoards(pos, newPositions);
     uint64 count = 0;
@@ -227,6 +463,161 @@ uint64 Game::perft(HexaBitBoardPosition *pos, int depth)
     return count;
 }
 
+void Game::perftSplit(HexaBitBoardPosition *pos, int depth, HexaBitBoardPosition *leaves, int *nLeaves)
+{
+    if (depth == 0)
+    {
+        leaves[(*nLeaves)++] = *pos;
+        return;
+    }
+
+    HexaBitBoardPosition newPositions[MAX_MOVES];
+    int nMoves = BitBoardUtils::GenerateBoards(pos, newPositions);
+
+    for (int i = 0; i < nMoves; i++)
+    {
+        perftSplit(&newPositions[i], depth - 1, leaves, nLeaves);
+    }
+}
+
+// hashed perft
+// every node (except the ones at depth 1 that are bulk counted) is looked up in and stored to perft TT
+uint64 Game::perft_hashed(HexaBitBoardPosition *pos, uint64 hash, int depth)
+{
+    if (depth == 1)
+    {
+        return (uint64) BitBoardUtils::CountMoves(pos);
+    }
+
+    uint64 count = 0;
+    if (TranspositionTable::lookup_perft(hash, depth, &count))
+    {
+        return count;
+    }
+
+#if USE_BATCHED_MOVE_COUNT == 1
+    // children at depth 1 aren't hashed, so we don't need their hashes
+    if (depth == 2 && BitBoardUtils::GetSimdAttackMode() != SIMD_ATTACKS_NONE)
+    {
+        HexaBitBoardBatch batch;
+        int nMoves = BitBoardUtils::GenerateBoards(pos, &batch);
+        count = BitBoardUtils::CountMovesBatch(&batch, nMoves, !pos->chance, NULL);
+        TranspositionTable::update_perft(hash, depth, count);
+        return count;
+    }
+#endif
+
+    // need moves (and not boards) to update the hash incrementally
+    CMove moves[MAX_MOVES];
+    int nMoves = BitBoardUtils::GenerateMoves(pos, moves);
+
+    for (int i = 0; i < nMoves; i++)
+    {
+        HexaBitBoardPosition newPos = *pos;
+        uint64 newHash = hash;
+        BitBoardUtils::MakeMove(&newPos, newHash, moves[i]);
+        count += perft_hashed(&newPos, newHash, depth - 1);
+    }
+
+    TranspositionTable::update_perft(hash, depth, count);
+
+    return count;
+}
+
+void Game::PerftThreadMain(int threadId, HexaBitBoardPosition *positions, int nPositions, int depth, bool hashed,
+                           std::atomic<int> *nextPosition, uint64 *threadNodes, int *threadPositions, uint64 *threadTime)
+{
+    Timer timer;
+    timer.start();
+
+    uint64 count = 0;
+    int processed = 0;
+
+    while (true)
+    {
+        int i = (*nextPosition)++;
+        if (i >= nPositions)
+            break;
+
+        if (hashed)
+            count += perft_hashed(&positions[i], BitBoardUtils::ComputeZobristKey(&positions[i]), depth);
+        else
+            count += perft(&positions[i], depth);
+        processed++;
+    }
+
+    threadNodes[threadId] = count;
+    threadPositions[threadId] = processed;
+    threadTime[threadId] = timer.getElapsedMicroSeconds();
+}
+
+uint64 Game::ParallelPerft(int depth, int nThreads, int splitPly, bool hashed, uint64 *threadNodes, int *threadPositions, uint64 *threadTime)
+{
+    if (depth >= MAX_PERFT_DEPTH)
+        hashed = false;
+
+    if (hashed && !TranspositionTable::isPerftAllocated())
+        TranspositionTable::initPerft();
+
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > MAX_SEARCH_THREADS)
+        nThreads = MAX_SEARCH_THREADS;
+
+    memset(threadNodes, 0, sizeof(uint64) * MAX_SEARCH_THREADS);
+    memset(threadPositions, 0, sizeof(int) * MAX_SEARCH_THREADS);
+    memset(threadTime, 0, sizeof(uint64) * MAX_SEARCH_THREADS);
+
+    // need at least one ply below the split point
+    if (splitPly > depth - 1)
+        splitPly = depth - 1;
+
+    if (splitPly < 1)
+    {
+        Timer timer;
+        timer.start();
+        threadNodes[0] = hashed ? perft_hashed(&pos, BitBoardUtils::ComputeZobristKey(&pos), depth) : perft(&pos, depth);
+        threadPositions[0] = 1;
+        threadTime[0] = timer.getElapsedMicroSeconds();
+        return threadNodes[0];
+    }
+
+    // no of positions at split ply is same as perft at that depth
+    int nPositions = (int) perft(&pos, splitPly);
+    HexaBitBoardPosition *positions = (HexaBitBoardPosition *) malloc(sizeof(HexaBitBoardPosition) * (nPositions + 1));
+    if (positions == NULL)
+    {
+        printf("info string failed to allocate %llu KB for the %d perft split positions\n",
+               (uint64) sizeof(HexaBitBoardPosition) * (nPositions + 1) / 1024, nPositions);
+        return 0;
+    }
+
+    int nLeaves = 0;
+    perftSplit(&pos, splitPly, positions, &nLeaves);
+    assert(nLeaves == nPositions);
+
+    std::atomic<int> nextPosition(0);
+    std::thread *threads[MAX_SEARCH_THREADS];
+    for (int i = 1; i < nThreads; i++)
+    {
+        threads[i] = new std::thread(PerftThreadMain, i, positions, nPositions, depth - splitPly, hashed, &nextPosition, threadNodes, threadPositions, threadTime);
+    }
+
+    // the calling thread also works on the queue
+    PerftThreadMain(0, positions, nPositions, depth - splitPly, hashed, &nextPosition, threadNodes, threadPositions, threadTime);
+
+    uint64 count = threadNodes[0];
+    for (int i = 1; i < nThreads; i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+        count += threadNodes[i];
+    }
+
+    free(positions);
+    return count;
+}
+
 
 // tester perft routine
 // check if ordered (MVV-LVA) move gen is working
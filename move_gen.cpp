@@ -2353,8 +2353,7 @@ int BitBoardUtils::generateMovesOutOfCheck(const ExpandedBitBoard *bb, CMove *ge
             while (knightMoves)
             {
                 uint64 dst = getOne(knightMoves);
-                // TODO: set capture flag correctly
-                addCompactMove(&nMoves, &genMoves, bitScan(knight), bitScan(dst), 0);
+                addCompactMove(&nMoves, &genMoves, bitScan(knight), bitScan(dst), (dst & bb->enemyPieces) ? CM_FLAG_CAPTURE : CM_FLAG_QUIET_MOVE);
                 knightMoves ^= dst;
             }
             myKnights ^= knight;
@@ -2370,8 +2369,7 @@ int BitBoardUtils::generateMovesOutOfCheck(const ExpandedBitBoard *bb, CMove *ge
             while (bishopMoves)
             {
                 uint64 dst = getOne(bishopMoves);
-                // TODO: set capture flag correctly
-                addCompactMove(&nMoves, &genMoves, bitScan(bishop), bitScan(dst), 0);
+                addCompactMove(&nMoves, &genMoves, bitScan(bishop), bitScan(dst), (dst & bb->enemyPieces) ? CM_FLAG_CAPTURE : CM_FLAG_QUIET_MOVE);
                 bishopMoves ^= dst;
             }
             bishops ^= bishop;
@@ -2387,8 +2385,7 @@ int BitBoardUtils::generateMovesOutOfCheck(const ExpandedBitBoard *bb, CMove *ge
             while (rookMoves)
             {
                 uint64 dst = getOne(rookMoves);
-                // TODO: set capture flag correctly
-                addCompactMove(&nMoves, &genMoves, bitScan(rook), bitScan(dst), 0);
+                addCompactMove(&nMoves, &genMoves, bitScan(rook), bitScan(dst), (dst & bb->enemyPieces) ? CM_FLAG_CAPTURE : CM_FLAG_QUIET_MOVE);
                 rookMoves ^= dst;
             }
             rooks ^= rook;
@@ -2557,8 +2554,7 @@ int BitBoardUtils::generateMovesOutOfCheck(HexaBitBoardPosition *pos, CMove *gen
             while (knightMoves)
             {
                 uint64 dst = getOne(knightMoves);
-                // TODO: set capture flag correctly
-                addCompactMove(&nMoves, &genMoves, bitScan(knight), bitScan(dst), 0);
+                addCompactMove(&nMoves, &genMoves, bitScan(knight), bitScan(dst), (dst & enemyPieces) ? CM_FLAG_CAPTURE : CM_FLAG_QUIET_MOVE);
                 knightMoves ^= dst;
             }
             myKnights ^= knight;
@@ -2574,8 +2570,7 @@ int BitBoardUtils::generateMovesOutOfCheck(HexaBitBoardPosition *pos, CMove *gen
             while (bishopMoves)
             {
                 uint64 dst = getOne(bishopMoves);
-                // TODO: set capture flag correctly
-                addCompactMove(&nMoves, &genMoves, bitScan(bishop), bitScan(dst), 0);
+                addCompactMove(&nMoves, &genMoves, bitScan(bishop), bitScan(dst), (dst & enemyPieces) ? CM_FLAG_CAPTURE : CM_FLAG_QUIET_MOVE);
                 bishopMoves ^= dst;
             }
             bishops ^= bishop;
@@ -2591,8 +2586,7 @@ int BitBoardUtils::generateMovesOutOfCheck(HexaBitBoardPosition *pos, CMove *gen
             while (rookMoves)
             {
                 uint64 dst = getOne(rookMoves);
-                // TODO: set capture flag correctly
-                addCompactMove(&nMoves, &genMoves, bitScan(rook), bitScan(dst), 0);
+                addCompactMove(&nMoves, &genMoves, bitScan(rook), bitScan(dst), (dst & enemyPieces) ? CM_FLAG_CAPTURE : CM_FLAG_QUIET_MOVE);
                 rookMoves ^= dst;
             }
             rooks ^= rook;
@@ -2988,6 +2982,131 @@ int BitBoardUtils::CountMoves(HexaBitBoardPosition *pos)
     return nMoves;
 }
 
+#if USE_BATCHED_MOVE_COUNT == 1
+// batched move counting
+// each SIMD lane holds a different position, so the set-wise (kogge-stone) move generation
+// is used instead of magics. The bulk of moves are counted using the fact that moves in a single direction
+// by different pieces of the same side can't land on the same square, so the moves can be counted per direction
+// as bits of a bitboard (without looping over pieces).
+typedef uint64 u64x4 __attribute__((vector_size(32)));
+typedef uint64 u64x8 __attribute__((vector_size(64)));
+
+// everything used by the kernel must be inlined into the AVX2/AVX-512 versions of it
+#define BATCH_INLINE static inline __attribute__((always_inline))
+
+// shift amount and the mask for bits wrapping around the board edge, for the 8 directions
+#define DIR_NORTH       8, ALLSET
+#define DIR_SOUTH      -8, ALLSET
+#define DIR_EAST        1, ~FILEA
+#define DIR_WEST       -1, ~FILEH
+#define DIR_NORTH_EAST  9, ~FILEA
+#define DIR_NORTH_WEST  7, ~FILEH
+#define DIR_SOUTH_EAST -7, ~FILEA
+#define DIR_SOUTH_WEST -9, ~FILEH
+
+// the kernel is compiled for each vector width with the matching instruction set enabled
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace BatchAVX2
+{
+#include "batch_move_count.h"
+}
+#pragma GCC pop_options
+
+#if USE_AVX512_ATTACKS == 1
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace BatchAVX512
+{
+#include "batch_move_count.h"
+}
+#pragma GCC pop_options
+#endif
+
+TARGET_AVX2 static uint32 countMovesBatchAVX2(const HexaBitBoardBatch *batch, int base, uint8 chance, uint32 *counts)
+{
+    if (chance == WHITE)
+        return BatchAVX2::countMovesBatchKernel<u64x4, 4, WHITE>(batch, base, counts);
+    else
+        return BatchAVX2::countMovesBatchKernel<u64x4, 4, BLACK>(batch, base, counts);
+}
+
+#if USE_AVX512_ATTACKS == 1
+TARGET_AVX512 static uint32 countMovesBatchAVX512(const HexaBitBoardBatch *batch, int base, uint8 chance, uint32 *counts)
+{
+    if (chance == WHITE)
+        return BatchAVX512::countMovesBatchKernel<u64x8, 8, WHITE>(batch, base, counts);
+    else
+        return BatchAVX512::countMovesBatchKernel<u64x8, 8, BLACK>(batch, base, counts);
+}
+#endif
+
+int BitBoardUtils::GenerateBoards(HexaBitBoardPosition *pos, HexaBitBoardBatch *batch)
+{
+    HexaBitBoardPosition newPositions[MAX_MOVES];
+    int nMoves = GenerateBoards(pos, newPositions);
+
+    for (int i = 0; i < nMoves; i++)
+    {
+        batch->whitePieces[i]  = newPositions[i].whitePieces;
+        batch->pawns[i]        = newPositions[i].pawns;
+        batch->knights[i]      = newPositions[i].knights;
+        batch->bishopQueens[i] = newPositions[i].bishopQueens;
+        batch->rookQueens[i]   = newPositions[i].rookQueens;
+        batch->kings[i]        = newPositions[i].kings;
+    }
+    return nMoves;
+}
+
+uint64 BitBoardUtils::CountMovesBatch(const HexaBitBoardBatch *batch, int nPositions, uint8 chance, uint32 *counts)
+{
+    int width = 1;
+    if (simdAttackMode == SIMD_ATTACKS_AVX2)
+        width = 4;
+#if USE_AVX512_ATTACKS == 1
+    if (simdAttackMode == SIMD_ATTACKS_AVX512)
+        width = 8;
+#endif
+
+    uint64 total = 0;
+    for (int i = 0; i < nPositions; i += width)
+    {
+        // the last group can go past nPositions (into the padding)
+        uint32 laneCounts[8];
+        uint32 checkMask = BIT(width) - 1;
+        if (width == 4)
+            checkMask = countMovesBatchAVX2(batch, i, chance, laneCounts);
+#if USE_AVX512_ATTACKS == 1
+        else if (width == 8)
+            checkMask = countMovesBatchAVX512(batch, i, chance, laneCounts);
+#endif
+
+        int n = (nPositions - i < width) ? nPositions - i : width;
+        for (int j = 0; j < n; j++)
+        {
+            // count the moves out of check (and everything when SIMD is off) the regular way
+            if (checkMask & BIT(j))
+            {
+                HexaBitBoardPosition pos;
+                pos.whitePieces  = batch->whitePieces[i + j];
+                pos.pawns        = batch->pawns[i + j];
+                pos.knights      = batch->knights[i + j];
+                pos.bishopQueens = batch->bishopQueens[i + j];
+                pos.rookQueens   = batch->rookQueens[i + j];
+                pos.kings        = batch->kings[i + j];
+                laneCounts[j] = (chance == WHITE) ? countMoves<WHITE>(&pos) : countMoves<BLACK>(&pos);
+            }
+
+            total += laneCounts[j];
+            if (counts)
+                counts[i + j] = laneCounts[j];
+        }
+    }
+
+    return total;
+}
+#endif
+
 int BitBoardUtils::GenerateMoves(HexaBitBoardPosition *pos, CMove *genMoves)
 {
     int nMoves;
@@ -3003,6 +3122,222 @@ int BitBoardUtils::GenerateMoves(HexaBitBoardPosition *pos, CMove *genMoves)
     return nMoves;
 }
 
+// check if the move could have been generated by the move generators in the given position
+// (ignoring pins and checks - those are verified separately)
+template<uint8 chance>
+bool BitBoardUtils::isPseudoLegalMove(const ExpandedBitBoard *bb, CMove move)
+{
+    uint8  flags = move.getFlags();
+    uint64 src   = BIT(move.getFrom());
+    uint64 dst   = BIT(move.getTo());
+
+    // the moving piece must belong to the side to move and it can't capture own piece
+    if (!(src & bb->myPieces) || (dst & bb->myPieces))
+        return false;
+
+    bool isCapture = !!(flags & CM_FLAG_CAPTURE);
+
+    if (src & bb->myPawns)
+    {
+        // promotion flag must be set for (and only for) moves reaching the last rank
+        uint64 lastRank = (chance == WHITE) ? RANK8 : RANK1;
+        if (!(flags & CM_FLAG_PROMOTION) != !(dst & lastRank))
+            return false;
+
+        uint64 pawnAttacks = (chance == WHITE) ? (northEastOne(src) | northWestOne(src)) :
+                                                 (southEastOne(src) | southWestOne(src));
+
+        if (flags == CM_FLAG_EP_CAPTURE)
+        {
+            if (!bb->enPassent)
+                return false;
+
+            uint64 enPassentTarget = BIT(bb->enPassent - 1) << (8 * ((chance == WHITE) ? 5 : 2));
+            return (dst == enPassentTarget) && (pawnAttacks & dst);
+        }
+
+        if (isCapture)
+        {
+            // (flags 6 and 7 are unused)
+            return (flags == CM_FLAG_CAPTURE || (flags & CM_FLAG_PROMOTION)) &&
+                   (pawnAttacks & dst & bb->enemyPieces);
+        }
+
+        uint64 singlePush = ((chance == WHITE) ? northOne(src) : southOne(src)) & (~bb->allPieces);
+        if (flags == CM_FLAG_DOUBLE_PAWN_PUSH)
+        {
+            uint64 checkingRankDoublePush = (chance == WHITE) ? RANK3 : RANK6;
+            uint64 doublePush = ((chance == WHITE) ? northOne(singlePush & checkingRankDoublePush) :
+                                                     southOne(singlePush & checkingRankDoublePush)) & (~bb->allPieces);
+            return dst == doublePush;
+        }
+
+        if (flags == CM_FLAG_QUIET_MOVE || (flags & CM_FLAG_PROMOTION))
+        {
+            return dst == singlePush;
+        }
+
+        return false;
+    }
+
+    if (src & bb->myKing)
+    {
+        if (flags == CM_FLAG_KING_CASTLE || flags == CM_FLAG_QUEEN_CASTLE)
+        {
+            // can't castle out of check
+            if (bb->myKing & bb->threatened)
+                return false;
+
+            // same conditions as used by the move generator
+            if (chance == WHITE)
+            {
+                if (flags == CM_FLAG_KING_CASTLE)
+                    return move.getFrom() == E1 && move.getTo() == G1 && (bb->whiteCastle & CASTLE_FLAG_KING_SIDE) &&
+                           !(F1G1 & bb->allPieces) && !(F1G1 & bb->threatened);
+                else
+                    return move.getFrom() == E1 && move.getTo() == C1 && (bb->whiteCastle & CASTLE_FLAG_QUEEN_SIDE) &&
+                           !(B1D1 & bb->allPieces) && !(C1D1 & bb->threatened);
+            }
+            else
+            {
+                if (flags == CM_FLAG_KING_CASTLE)
+                    return move.getFrom() == E8 && move.getTo() == G8 && (bb->blackCastle & CASTLE_FLAG_KING_SIDE) &&
+                           !(F8G8 & bb->allPieces) && !(F8G8 & bb->threatened);
+                else
+                    return move.getFrom() == E8 && move.getTo() == C8 && (bb->blackCastle & CASTLE_FLAG_QUEEN_SIDE) &&
+                           !(B8D8 & bb->allPieces) && !(C8D8 & bb->threatened);
+            }
+        }
+    }
+
+    // only pawns and kings have special moves, and the capture flag must match the destination square
+    if ((flags != CM_FLAG_QUIET_MOVE && flags != CM_FLAG_CAPTURE) ||
+        isCapture != !!(dst & bb->enemyPieces))
+    {
+        return false;
+    }
+
+    if (src & bb->myKing)
+    {
+#if USE_KING_LUT == 1
+        return !!(sqKingAttacks(move.getFrom()) & dst);
+#else
+        return !!(kingAttacks(src) & dst);
+#endif
+    }
+
+    if (src & bb->myKnights)
+    {
+#if USE_KNIGHT_LUT == 1
+        return !!(sqKnightAttacks(move.getFrom()) & dst);
+#else
+        return !!(knightAttacks(src) & dst);
+#endif
+    }
+
+    // sliding pieces (queens are present in both the sets)
+    if ((src & bb->myBishopQueens) && (bishopAttacks(src, ~bb->allPieces) & dst))
+        return true;
+
+    if ((src & bb->myRookQueens) && (rookAttacks(src, ~bb->allPieces) & dst))
+        return true;
+
+    return false;
+}
+
+// check if the move is legal in the given position
+// pseudo-legal check + pins/checks using the pinned and threatened masks (no need to make the move)
+template<uint8 chance>
+bool BitBoardUtils::isLegalMove(const ExpandedBitBoard *bb, CMove move)
+{
+    if (!isPseudoLegalMove<chance>(bb, move))
+        return false;
+
+    uint8  flags = move.getFlags();
+    uint64 src   = BIT(move.getFrom());
+    uint64 dst   = BIT(move.getTo());
+
+    // king can't move to a square under threat
+    // (threatened squares are computed as if the king is not there - so moving along the line of an attacker is also caught)
+    // castling conditions are already checked above
+    if (src & bb->myKing)
+    {
+        return !(dst & bb->threatened);
+    }
+
+    uint64 enPassentCapturedPiece = 0;
+    if (flags == CM_FLAG_EP_CAPTURE)
+    {
+        enPassentCapturedPiece = (chance == WHITE) ? southOne(dst) : northOne(dst);
+    }
+
+    if (bb->myKing & bb->threatened)
+    {
+        // pieces that are pinned don't have any hope of saving the king
+        if (src & bb->pinned)
+            return false;
+
+        uint64 king = bb->myKing;
+        uint64 attackers = 0;
+        attackers |= ((chance == WHITE) ? (northEastOne(king) | northWestOne(king)) :
+                      (southEastOne(king) | southWestOne(king))) & bb->enemyPawns;
+#if USE_KNIGHT_LUT == 1
+        attackers |= sqKnightAttacks(bb->myKingIndex) & bb->enemyKnights;
+#else
+        attackers |= knightAttacks(king) & bb->enemyKnights;
+#endif
+        attackers |= bishopAttacks(king, ~bb->allPieces) & bb->enemyBishopQueens;
+        attackers |= rookAttacks(king, ~bb->allPieces) & bb->enemyRookQueens;
+
+        // multiple attackers => only king moves possible
+        if (isMultiple(attackers))
+            return false;
+
+        // the move must kill the attacker or block it's path to the king
+        uint64 safeSquares = attackers | sqsInBetween(bb->myKingIndex, bitScan(attackers));
+        if (!(dst & safeSquares) && enPassentCapturedPiece != attackers)
+            return false;
+    }
+    else if (src & bb->pinned)
+    {
+        // pinned piece can only move along the line joining it and the king
+        if (!(dst & sqsInLine(move.getFrom(), bb->myKingIndex)))
+            return false;
+    }
+
+    // en-passent is special as it removes two pieces from the same rank (possibly exposing the king)
+    if (flags == CM_FLAG_EP_CAPTURE && !(src & bb->pinned))
+    {
+        uint64 propogator = (~bb->allPieces) | enPassentCapturedPiece | src;
+        uint64 causesCheck = (eastAttacks(bb->enemyRookQueens, propogator) | westAttacks(bb->enemyRookQueens, propogator)) &
+                             (bb->myKing);
+        if (causesCheck)
+            return false;
+    }
+
+    return true;
+}
+
+bool BitBoardUtils::IsLegalMove(HexaBitBoardPosition *pos, CMove move)
+{
+    if (pos->chance == BLACK)
+    {
+        ExpandedBitBoard bb = ExpandBitBoard<BLACK>(pos);
+        return isLegalMove<BLACK>(&bb, move);
+    }
+    else
+    {
+        ExpandedBitBoard bb = ExpandBitBoard<WHITE>(pos);
+        return isLegalMove<WHITE>(&bb, move);
+    }
+}
+
+
+template bool BitBoardUtils::isPseudoLegalMove<WHITE>(const ExpandedBitBoard *bb, CMove move);
+template bool BitBoardUtils::isPseudoLegalMove<BLACK>(const ExpandedBitBoard *bb, CMove move);
+
+template bool BitBoardUtils::isLegalMove<WHITE>(const ExpandedBitBoard *bb, CMove move);
+template bool BitBoardUtils::isLegalMove<BLACK>(const ExpandedBitBoard *bb, CMove move);
 
 template int BitBoardUtils::generateCaptures<WHITE>(const ExpandedBitBoard *bb, CMove *genMoves);
 template int BitBoardUtils::generateCaptures<BLACK>(const ExpandedBitBoard *bb, CMove *genMoves);
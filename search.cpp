@@ -1,14 +1,71 @@
 #include "chess.h"
+#include <math.h>
 
 // good page on quiescent-search
 // http://web.archive.org/web/20040427014440/brucemo.com/compchess/programming/quiescent.htm#MVVLVA
 
+// reading the clock is much more expensive than checking the flag, so do it only every few nodes
+// the search unwinds (without updating the TT) as soon as the flag is set
+bool Game::checkStop(SearchContext *ctx)
+{
+    if (++ctx->nodesSinceStopCheck >= STOP_CHECK_INTERVAL)
+    {
+        ctx->nodesSinceStopCheck = 0;
+        if (ctx->timer.stop() > ctx->searchTimeLimit)
+        {
+            ctx->stop.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    return ctx->stop.load(std::memory_order_relaxed);
+}
+
+int16 Game::staticEval(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int16 alpha, int16 beta)
+{
+    int16 eval;
+
+#if USE_EVAL_CACHE == 1
+    ctx->evalCacheProbes++;
+    if (TranspositionTable::lookup_eval(hash, &eval))
+    {
+        ctx->evalCacheHits++;
+        assert(eval == BitBoardUtils::Evaluate(pos, ctx, evalState));
+        return eval;
+    }
+#endif
+
+#if USE_LAZY_EVAL == 1
+    // lazy eval scores are not exact, so they are not stored in the eval cache
+    if (lazyEval && (alpha > -INF || beta < INF))
+    {
+        ctx->lazyEvalProbes++;
+        if (BitBoardUtils::EvaluateLazy(pos, evalState, alpha, beta, lazyEvalMargin, &eval))
+        {
+            ctx->lazyEvalExits++;
+            return eval;
+        }
+    }
+#endif
+
+    eval = BitBoardUtils::Evaluate(pos, ctx, evalState);
+#if USE_EVAL_CACHE == 1
+    TranspositionTable::update_eval(hash, eval);
+#endif
+    return eval;
+}
+
 // Quiescence search
 template<uint8 chance>
-int16 Game::q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 alpha, int16 beta, int curPly)
+int16 Game::q_search(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int16 alpha, int16 beta, int curPly)
 {
+    if (checkStop(ctx))
+        return 0;
 
-    nodes++;    // node count is the no. of nodes on which Evaluation function is called
+    ctx->nodes++;    // node count is the no. of nodes on which Evaluation function is called
+
+#if USE_DELTA_PRUNING == 1
+    ctx->qNodes++;
+#endif
 
     bool improvedAlpha = false;
 
@@ -29,7 +86,7 @@ int16 Game::q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 al
     int16 currentMax = -INF;
 
     // check current position
-    int16 stand_pat = BitBoardUtils::Evaluate(pos);
+    int16 stand_pat = staticEval(ctx, pos, hash, evalState, alpha, beta);
     
     if (stand_pat >= beta)
     {
@@ -39,7 +96,7 @@ int16 Game::q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 al
 
 #if Q_SEARCH_CHECK_EXTENSIONS == 1
     // to detect infinite check->check evasion loops
-    posHashes[curPly] = hash;
+    ctx->posHashes[curPly] = hash;
 #endif
 
     currentMax = stand_pat;
@@ -70,22 +127,35 @@ int16 Game::q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 al
     {
         nMoves = BitBoardUtils::generateCaptures<chance>(&bb, newMoves);                // generate captures in MVV-LVA order
 
-        // sorting captures using SEE doesn't seem to benefit at all :-(
+#if USE_Q_SEARCH_SEE_PRUNING == 1
+        // search captures in SEE order (MVV-LVA order is kept for captures with same SEE score)
+        // and drop the ones that lose material
+        nMoves = SortCapturesSEE<chance>(pos, newMoves, nMoves, 0);
+#endif
     }
 
     for (int i = 0; i < nMoves; i++)
     {
-#if USE_Q_SEARCH_SEE_PRUNING == 1
-        if ((!inCheck) && BitBoardUtils::EvaluateSEE<chance>(pos, newMoves[i]) <= 0)
+#if USE_DELTA_PRUNING == 1
+        // even winning the captured piece isn't going to be enough to reach alpha
+        if (deltaPruning && (!inCheck) &&
+            stand_pat + BitBoardUtils::MaterialGain(pos, newMoves[i]) + deltaPruningMargin <= alpha)
+        {
+            ctx->deltaPrunes++;
             continue;
+        }
 #endif
 
         HexaBitBoardPosition newPos = *pos;
         uint64 newhash = hash;
+        EvalState newEvalState = evalState;
+
+        BitBoardUtils::MakeMove(&newPos, newhash, newEvalState, newMoves[i]);
 
-        BitBoardUtils::MakeMove(&newPos, newhash, newMoves[i]);
+        int16 curScore = -q_search<!chance>(ctx, &newPos, newhash, newEvalState, depth - 1, -beta, -alpha, curPly + 1);
+        if (ctx->stop)
+            return 0;
 
-        int16 curScore = -q_search<!chance>(&newPos, newhash, depth - 1, -beta, -alpha, curPly + 1);
         if (curScore >= beta)
         {
             TranspositionTable::update_q(hash, curScore, SCORE_GE);
@@ -111,7 +181,7 @@ int16 Game::q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 al
         // TODO: no need to search so many plies - reset the counter whenever a capture is made
         for (int i = 0; i < curPly; i++)
         {
-            if (posHashes[i] == hash)
+            if (ctx->posHashes[i] == hash)
             {
                 return 0;   // draw by repetition
             }
@@ -123,10 +193,14 @@ int16 Game::q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 al
         {
             HexaBitBoardPosition newPos = *pos;
             uint64 newhash = hash;
+            EvalState newEvalState = evalState;
+
+            BitBoardUtils::MakeMove(&newPos, newhash, newEvalState, newMoves[i]);
 
-            BitBoardUtils::MakeMove(&newPos, newhash, newMoves[i]);
+            int16 curScore = -q_search<!chance>(ctx, &newPos, newhash, newEvalState, depth - 1, -beta, -alpha, curPly + 1);
+            if (ctx->stop)
+                return 0;
 
-            int16 curScore = -q_search<!chance>(&newPos, newhash, depth - 1, -beta, -alpha, curPly + 1);
             if (curScore >= beta)
             {
                 TranspositionTable::update_q(hash, curScore, SCORE_GE);
@@ -155,7 +229,7 @@ int16 Game::q_search(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 al
 
 // update history
 // TODO: do we want to clear history tables after every move actually made ?
-void Game::UpdateHistory(HexaBitBoardPosition *pos, CMove move, int depth, uint8 chance, bool betaCutoff)
+void Game::UpdateHistory(SearchContext *ctx, HexaBitBoardPosition *pos, CMove move, int depth, uint8 chance, bool betaCutoff)
 {
 #if USE_HISTORY_HEURISTIC == 1
 
@@ -173,85 +247,61 @@ void Game::UpdateHistory(HexaBitBoardPosition *pos, CMove move, int depth, uint8
     // update history table
     if (betaCutoff)
     {
-        historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] += depth * depth;
-        if (historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] > INT_MAX)
+        ctx->historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] += depth * depth;
+        if (ctx->historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] > INT_MAX)
         {
-            historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
-            butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
+            ctx->historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
+            ctx->butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
         }
     }
     else
     {
         // update butterfly table
-        butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] += depth * depth;
-        if (butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] > INT_MAX)
+        ctx->butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] += depth * depth;
+        if (ctx->butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] > INT_MAX)
         {
-            butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
-            historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
+            ctx->butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
+            ctx->historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] /= 2;
         }
     }
 #endif
 }
 
-// sort quiet moves based on history heuristic
-void Game::SortMovesHistory(HexaBitBoardPosition *pos, CMove* moves, int nMoves, uint8 chance)
+// score of a quiet move based on history heuristic
+float Game::GetHistoryScore(SearchContext *ctx, HexaBitBoardPosition *pos, CMove move, uint8 chance)
 {
-    float scores[MAX_MOVES];
-    for (int i = 0; i < nMoves; i++)
-    {
-        if (!moves[i].isValid())
-        {
-            scores[i] = 0.0f;
-            continue;
-        }
-
 #if HISTORY_PER_PIECE == 1
-        uint8 piece = BitBoardUtils::getPieceAtSquare(pos, BIT(moves[i].getFrom())) - 1;
-        #define ARRAY_DIM [piece]
+    uint8 piece = BitBoardUtils::getPieceAtSquare(pos, BIT(move.getFrom())) - 1;
+    #define ARRAY_DIM [piece]
 #else
-        #define ARRAY_DIM
+    #define ARRAY_DIM
 #endif
 
-        if (butterflyScore[chance]ARRAY_DIM[moves[i].getFrom()][moves[i].getTo()] == 0)
-        {
-            scores[i] = (float) historyScore[chance]ARRAY_DIM[moves[i].getFrom()][moves[i].getTo()];
-        }
-        else
-        {
-            scores[i] = ((float)   historyScore[chance]ARRAY_DIM[moves[i].getFrom()][moves[i].getTo()]) /
-                                 butterflyScore[chance]ARRAY_DIM[moves[i].getFrom()][moves[i].getTo()] ;
-        }
+    if (ctx->butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] == 0)
+    {
+        return (float) ctx->historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()];
     }
-
-    // sort move list based on score 
-    // use insertion sort - might be too slow 
-    // TODO: (we better avoid sorting and try picking best from the list when trying out moves (faster if we have a beta cutoff soon...)
-    for (int i = 1; i < nMoves; i++)
+    else
     {
-        int j = i;
-        float scoreX = scores[j];
-        CMove moveX = moves[j];
-        while (j > 0 && scores[j - 1] < scoreX)
-        {
-            scores[j] = scores[j - 1];
-            moves[j] = moves[j - 1];
-            j--;
-        }
-        scores[j] = scoreX;
-        moves[j] = moveX;
+        return ((float)   ctx->historyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()]) /
+                        ctx->butterflyScore[chance]ARRAY_DIM[move.getFrom()][move.getTo()] ;
     }
 }
 
-// returns the index of first non-winning capture (or the no. of winning captures)
+// returns the index of first capture with SEE score less than minScore (or the no. of captures scoring at least minScore)
 template<uint8 chance>
-int16 Game::SortCapturesSEE(HexaBitBoardPosition *pos, CMove* captures, int nMoves)
+int16 Game::SortCapturesSEE(HexaBitBoardPosition *pos, CMove* captures, int nMoves, int16 minScore)
 {
     int16 scores[MAX_MOVES];
 
     // 1. evaluate all caputres using SEE
     for (int i = 0; i < nMoves; i++)
     {
+#if USE_FAST_SEE == 1
+        scores[i] = BitBoardUtils::EvaluateSEEFast<chance>(pos, captures[i]);
+#else
         scores[i] = BitBoardUtils::EvaluateSEE<chance>(pos, captures[i]);
+#endif
     }
 
     // sort captures list based on score 
@@ -271,35 +321,289 @@ int16 Game::SortCapturesSEE(HexaBitBoardPosition *pos, CMove* captures, int nMov
         captures[j] = moveX;
     }
 
-    // find the index of first non-winning capture
+    // find the index of first capture scoring less than minScore
     // we can use binary search or merge this with the outer loop of the above block - but the complexity is not worth it
-    int winningCaptures = 0;
-    while (winningCaptures < nMoves &&
-           scores[winningCaptures] > 0)
+    int goodCaptures = 0;
+    while (goodCaptures < nMoves &&
+           scores[goodCaptures] >= minScore)
     {
-        winningCaptures++;
+        goodCaptures++;
     }
     
-    return winningCaptures;
+    return goodCaptures;
+}
+
+
+template<uint8 chance>
+MovePicker<chance>::MovePicker(SearchContext *ctx, HexaBitBoardPosition *pos, const ExpandedBitBoard *bb, CMove ttMove, int depth, bool inCheck)
+{
+    this->ctx     = ctx;
+    this->pos     = pos;
+    this->bb      = bb;
+    this->depth   = depth;
+    this->inCheck = inCheck;
+
+    stage = MP_TT_MOVE;
+    moveStage = MP_TT_MOVE;
+    nMoves = nCaptures = nGoodCaptures = 0;
+    current = 0;
+    sortMoves = false;
+
+    // the hash move might be garbage (hash collision, or an entry shared with other threads)
+    // make sure it's legal in this position before handing it out
+    if (ttMove.isValid() && !BitBoardUtils::isLegalMove<chance>(bb, ttMove))
+    {
+        ttMove = CMove();
+    }
+    this->ttMove = ttMove;
+
+    // make a copy as the killer table entry for this depth can be modified by child nodes (due to extensions)
+    killers[0] = ctx->killers[depth][0];
+    killers[1] = ctx->killers[depth][1];
+}
+
+template<uint8 chance>
+void MovePicker<chance>::scoreMoves()
+{
+    bool useHistory = false;
+#if USE_HISTORY_HEURISTIC == 1
+    useHistory = (depth >= HISTORY_SORT_MIN_DEPTH);
+#endif
+
+    // killers are tried first among the evasions
+    bool evasions = (stage == MP_GEN_EVASIONS);
+
+    // otherwise moves are picked in the order they were generated
+    sortMoves = useHistory || evasions;
+    if (!sortMoves)
+        return;
+
+    for (int i = nCaptures; i < nMoves; i++)
+    {
+        if (evasions && (moves[i] == killers[0] || moves[i] == killers[1]))
+            scores[i] = FLT_MAX;
+        else if (useHistory)
+            scores[i] = Game::GetHistoryScore(ctx, pos, moves[i], chance);
+        else
+            scores[i] = 0.0f;
+    }
+}
+
+// instead of sorting all the moves, find the best one each time (cheaper when we get a cutoff early)
+template<uint8 chance>
+CMove MovePicker<chance>::pickBest()
+{
+    if (sortMoves)
+    {
+        int best = current;
+        for (int i = current + 1; i < nMoves; i++)
+        {
+            if (scores[i] > scores[best])
+                best = i;
+        }
+
+        CMove move = moves[best];
+        moves[best] = moves[current];
+        scores[best] = scores[current];
+        moves[current] = move;
+    }
+
+    return moves[current++];
+}
+
+template<uint8 chance>
+CMove MovePicker<chance>::nextMove()
+{
+    while (true)
+    {
+        switch (stage)
+        {
+        case MP_TT_MOVE:
+            stage = inCheck ? MP_GEN_EVASIONS : MP_GEN_CAPTURES;
+            if (ttMove.isValid())
+            {
+                moveStage = MP_TT_MOVE;
+                return ttMove;
+            }
+            break;
+
+        case MP_GEN_CAPTURES:
+#if GATHER_STATS == 1
+            ctx->nonTTSearched++;
+#endif
+            nCaptures = BitBoardUtils::generateCaptures<chance>(bb, moves);        // generate captures in MVV-LVA order
+            nGoodCaptures = nCaptures;
+
+#if USE_SEE_MOVE_ORDERING == 1
+            // sorting captures using SEE is overall a loss and sometimes even results in bigger tree! Bug?
+            // searching losing captures after quiet moves results in even bigger tree! Another bug?
+            if (depth >= MIN_DEPTH_FOR_SEE)
+            {
+                nGoodCaptures = Game::SortCapturesSEE<chance>(pos, moves, nCaptures);
+            }
+#endif
+
+#if SEARCH_LOSING_CAPTURES_AFTER_KILLERS == 0
+            nGoodCaptures = nCaptures;
+#endif
+            nMoves = nCaptures;
+            current = 0;
+            stage = MP_GOOD_CAPTURES;
+            break;
+
+        case MP_GOOD_CAPTURES:
+            while (current < nGoodCaptures)
+            {
+                CMove move = moves[current++];
+                if (move != ttMove)
+                {
+                    moveStage = MP_GOOD_CAPTURES;
+                    return move;
+                }
+            }
+#if GATHER_STATS == 1
+            ctx->nonCaptureSearched++;
+#endif
+            current = 0;
+            stage = MP_KILLERS;
+            break;
+
+        case MP_KILLERS:
+            while (current < MAX_KILLERS)
+            {
+                CMove move = killers[current++];
+
+                // killers are always quiet moves (promotions are generated with captures)
+                if (move.isValid() && move != ttMove &&
+                    !(move.getFlags() & (CM_FLAG_CAPTURE | CM_FLAG_PROMOTION)) &&
+                    (current == 1 || move != killers[0]) &&
+                    BitBoardUtils::isLegalMove<chance>(bb, move))
+                {
+                    moveStage = MP_KILLERS;
+                    return move;
+                }
+            }
+            stage = MP_GEN_QUIETS;
+            break;
+
+        case MP_GEN_QUIETS:
+#if GATHER_STATS == 1
+            ctx->nonKillersSearched++;
+#endif
+            nMoves = nCaptures + BitBoardUtils::generateNonCaptures<chance>(bb, &moves[nCaptures]);
+            scoreMoves();
+            current = nCaptures;
+            stage = MP_QUIETS;
+            break;
+
+        case MP_QUIETS:
+            while (current < nMoves)
+            {
+                // TT move and killers have already been searched
+                CMove move = pickBest();
+                if (move != ttMove && move != killers[0] && move != killers[1])
+                {
+                    moveStage = MP_QUIETS;
+                    return move;
+                }
+            }
+            current = nGoodCaptures;
+            stage = MP_BAD_CAPTURES;
+            break;
+
+        case MP_BAD_CAPTURES:
+            while (current < nCaptures)
+            {
+                CMove move = moves[current++];
+                if (move != ttMove)
+                {
+                    moveStage = MP_BAD_CAPTURES;
+                    return move;
+                }
+            }
+            stage = MP_DONE;
+            break;
+
+        case MP_GEN_EVASIONS:
+#if GATHER_STATS == 1
+            ctx->nonTTSearched++;
+#endif
+            nMoves = BitBoardUtils::generateMovesOutOfCheck<chance>(bb, moves);
+            scoreMoves();
+            current = 0;
+            stage = MP_EVASIONS;
+            break;
+
+        case MP_EVASIONS:
+            while (current < nMoves)
+            {
+                CMove move = pickBest();
+                if (move != ttMove)
+                {
+                    moveStage = MP_EVASIONS;
+                    return move;
+                }
+            }
+            stage = MP_DONE;
+            break;
+
+        default:
+            return CMove();
+        }
+    }
 }
 
+uint8 Game::lmrTable[2][LMR_TABLE_DEPTH][LMR_TABLE_MOVES];
+bool  Game::lateMoveReductions = true;
+
+// reductions grow with log of both depth and move number (less for PV nodes)
+// see https://www.chessprogramming.org/Late_Move_Reductions
+void Game::initLMRTable()
+{
+    for (int depth = 0; depth < LMR_TABLE_DEPTH; depth++)
+        for (int moves = 0; moves < LMR_TABLE_MOVES; moves++)
+        {
+            if (depth == 0 || moves == 0)
+            {
+                lmrTable[0][depth][moves] = lmrTable[1][depth][moves] = 0;
+                continue;
+            }
+
+            double r = log((double) depth) * log((double) moves);
+            lmrTable[0][depth][moves] = (uint8) (0.75 + r / 2.25);
+            lmrTable[1][depth][moves] = (uint8) (r / 3.0);
+        }
+}
 
 // no of plies to reduce for LMR
-// no - longer used - we always reduce by 1 ply
-static int getLMRReduction(int depth, bool isPVNode, int movesSearched)
+int Game::getLMRReduction(int depth, bool isPVNode, int movesSearched, float historyScore)
 {
-    if (isPVNode)
-        return 1;
+    int d = depth < LMR_TABLE_DEPTH ? depth : LMR_TABLE_DEPTH - 1;
+    int m = movesSearched < LMR_TABLE_MOVES ? movesSearched : LMR_TABLE_MOVES - 1;
+    int r = lmrTable[isPVNode][d][m];
 
-    if (movesSearched <= 8)
-        return 1;
+    // moves that often caused cutoffs in the past are reduced less
+    if (historyScore > LMR_GOOD_HISTORY)
+        r--;
 
-    if (depth >= 6)
-        return 2;
+    // reduce at least 1 ply, and don't drop directly into q-search
+    if (r < 1)
+        r = 1;
+    if (r > depth - 2)
+        r = depth - 2;
 
-    return 1;
+    return r;
 }
 
+// margins (in centipawns) for static eval based pruning, indexed by remaining depth
+static const int16 futilityMargin[STATIC_PRUNING_MAX_DEPTH + 1]        = { 0, 200, 300, 500 };
+static const int16 reverseFutilityMargin[STATIC_PRUNING_MAX_DEPTH + 1] = { 0, 150, 300, 450 };
+static const int16 razorMargin[STATIC_PRUNING_MAX_DEPTH + 1]           = { 0, 300, 400, 600 };
+
+bool Game::futilityPruning        = true;
+bool Game::reverseFutilityPruning = true;
+bool Game::razoring               = true;
+
 // adjust mate score returned to the ply where we extended the depth
 static int16 adjustScoreForExtension(int16 score, bool extended)
 {
@@ -317,17 +621,33 @@ static int16 adjustScoreForExtension(int16 score, bool extended)
     return score;
 }
 
-// negamax forumlation of alpha-beta search
+// search a child node (newPos is the position after making move)
+// with PVS, only the first move is searched with the full window, rest of the moves are searched with a null window
+// to prove that they are not better than the best move found so far. A move that turns out to be better is re-searched with the full window
 template<uint8 chance>
-int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int curPly, int16 alpha, int16 beta, bool allowNullMove, CMove lastMove)
+int16 Game::searchMove(SearchContext *ctx, HexaBitBoardPosition *newPos, uint64 newHash, const EvalState &newEvalState, int depth, int curPly, int16 alpha, int16 beta, bool firstMove, CMove move)
 {
-    // check for timeout
-    if (depth > 3)
+#if USE_PVS == 1
+    if (!firstMove && beta > alpha + 1)
     {
-        uint64 timeElapsed = timer.stop();
-        if (timeElapsed > (searchTimeLimit))
-            throw std::exception();
+        int16 score = -alphabeta<!chance>(ctx, newPos, newHash, newEvalState, depth, curPly, -(alpha + 1), -alpha, true, move);
+        if (ctx->stop || score <= alpha || score >= beta)
+        {
+            return score;
+        }
     }
+#endif
+
+    return -alphabeta<!chance>(ctx, newPos, newHash, newEvalState, depth, curPly, -beta, -alpha, true, move);
+}
+
+// negamax forumlation of alpha-beta search
+template<uint8 chance>
+int16 Game::alphabeta(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int curPly, int16 alpha, int16 beta, bool allowNullMove, CMove lastMove)
+{
+    // check for timeout (or if the main thread asked helper threads to stop)
+    if (checkStop(ctx))
+        return 0;
 
     // expand bitboard structure (TODO: come up with something that doesn't need expanding ?)
     ExpandedBitBoard bb = BitBoardUtils::ExpandBitBoard<chance>(pos);
@@ -364,15 +684,15 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
 
     if (depth == 0)
     {
-        int16 qSearchVal = q_search<chance>(pos, hash, depth, alpha, beta, curPly);
+        int16 qSearchVal = q_search<chance>(ctx, pos, hash, evalState, depth, alpha, beta, curPly);
         return adjustScoreForExtension(qSearchVal, extendedDepth);
     }
 
     // detect draw by repetition
-    posHashes[curPly] = hash;
+    ctx->posHashes[curPly] = hash;
     for (int i = 0; i < curPly; i++)
     {
-        if (posHashes[i] == hash)
+        if (ctx->posHashes[i] == hash)
         {
             // don't update TT for draw by repetition
             return 0;   // draw by repetition
@@ -405,15 +725,16 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
         pos->chance = !pos->chance;
         uint64 newHash = hash ^ BitBoardUtils::zob.chance;
 
-        // 2. clear en-passent flag if set
+        // 2. clear en-passent flag if set (it's part of the hash only if the capture was possible)
         uint8 ep = pos->enPassent;
-        pos->enPassent = 0;
-        if (ep)
+        if (BitBoardUtils::IsEnPassentPossible(pos, chance))
         {
             newHash ^= BitBoardUtils::zob.enPassentTarget[ep - 1];
         }
+        pos->enPassent = 0;
+        assert(newHash == BitBoardUtils::ComputeZobristKey(pos));
 
-        int16 nullMoveScore = -alphabeta<!chance>(pos, newHash, depth - 1 - R, curPly + 1, -beta, -beta + 1, false, CMove(0));
+        int16 nullMoveScore = -alphabeta<!chance>(ctx, pos, newHash, evalState, depth - 1 - R, curPly + 1, -beta, -beta + 1, false, CMove(0));
 
         nullMoveScore = adjustScoreForExtension(nullMoveScore, extendedDepth);
         
@@ -422,6 +743,9 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
         pos->chance = !pos->chance;
         pos->enPassent = ep;
 
+        if (ctx->stop)
+            return 0;
+
         if (nullMoveScore >= beta) return nullMoveScore;
     }
 #endif    
@@ -454,6 +778,54 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
         }
     }
 
+    // static eval of the node (used for pruning near the horizon and for LMR)
+    // static eval based pruning is done only at non-PV nodes (null window) when not in check and not searching for mates
+    bool isPVNode = (beta > alpha + 1);
+    bool staticPruning = !isPVNode && !inCheck && depth <= STATIC_PRUNING_MAX_DEPTH &&
+                         abs(alpha) < MATE_SCORE_BASE / 2 && abs(beta) < MATE_SCORE_BASE / 2;
+
+    int16 standpat = 0;
+    if ((staticPruning && (futilityPruning || reverseFutilityPruning || razoring)) ||
+        (lateMoveReductions && depth >= LMR_MIN_DEPTH))
+    {
+        standpat = staticEval(ctx, pos, hash, evalState);
+    }
+
+#if USE_REVERSE_FUTILITY_PRUNING == 1
+    // reverse futility pruning (static null move): static eval is so far above beta that
+    // no quiet move is likely to bring it back below
+    if (staticPruning && reverseFutilityPruning && standpat - reverseFutilityMargin[depth] >= beta)
+    {
+        ctx->reverseFutilityPrunes++;
+        return standpat - reverseFutilityMargin[depth];
+    }
+#endif
+
+#if USE_RAZORING == 1
+    // razoring: static eval is far below alpha, verify with q-search that the captures can't bring it back
+    if (staticPruning && razoring && !ttMove.isValid() && standpat + razorMargin[depth] <= alpha)
+    {
+        // at depth 1 the q-search result is used directly
+        int16 razorAlpha = (depth == 1) ? alpha : alpha - razorMargin[depth];
+        int16 qSearchVal = q_search<chance>(ctx, pos, hash, evalState, 0, razorAlpha, razorAlpha + 1, curPly);
+        if (ctx->stop)
+            return 0;
+
+        if (depth == 1 || qSearchVal <= razorAlpha)
+        {
+            ctx->razorPrunes++;
+            return qSearchVal;
+        }
+    }
+#endif
+
+    // futility pruning: skip quiet moves (that don't give check) if even a big positional gain
+    // can't take the static eval above alpha
+    bool futile = false;
+#if USE_FUTILITY_PRUNING == 1
+    futile = staticPruning && futilityPruning && standpat + futilityMargin[depth] <= alpha;
+#endif
+
 
     // Internal iterative deepening
     // good discussion here:
@@ -470,7 +842,9 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
 
         if (hashDepth < iidDepth)
         {
-            alphabeta<chance>(pos, hash, iidDepth, curPly, alpha, beta, allowNullMove, lastMove);
+            alphabeta<chance>(ctx, pos, hash, evalState, iidDepth, curPly, alpha, beta, allowNullMove, lastMove);
+            if (ctx->stop)
+                return 0;
 
             // again query the TT (to get updated value)
             foundInTT = TranspositionTable::lookup(hash, depth, &hashScore, &scoreType, &hashDepth, &ttMove);
@@ -479,137 +853,130 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
 
 
 #if GATHER_STATS == 1
-    totalSearched++;
+    ctx->totalSearched++;
 #endif
 
     int16 currentMax = -INF;
 
     int movesSearched = 0;
 
+    // no of quiet moves searched (used for LMR)
+    int quietsSearched = 0;
+
     bool improvedAlpha = false;
 
-    // check hash move first
-    CMove currentBestMove = ttMove;
-    if (ttMove.isValid())
+    CMove currentBestMove = {};
+
+    // moves are generated lazily (stage by stage) by the move picker
+    MovePicker<chance> picker(ctx, pos, &bb, ttMove, depth, inCheck);
+
+    for (CMove move = picker.nextMove(); move.isValid(); move = picker.nextMove())
     {
         HexaBitBoardPosition newPos = *pos;
         uint64 newHash = hash;
-        BitBoardUtils::MakeMove(&newPos, newHash, ttMove);
+        EvalState newEvalState = evalState;
+        BitBoardUtils::MakeMove(&newPos, newHash, newEvalState, move);
 
-        movesSearched++;
-        int16 curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, ttMove);
+        // promotions are searched with the captures, everything else is a quiet move
+        bool isQuiet = !(move.getFlags() & (CM_FLAG_CAPTURE | CM_FLAG_PROMOTION));
+
+#if USE_FUTILITY_PRUNING == 1
+        if (futile && movesSearched > 0 && picker.getStage() == MP_QUIETS && !BitBoardUtils::IsInCheck(&newPos))
+        {
+            // the pruned move could still score up to the futility bound,
+            // so the upper bound stored for this node can't be any lower
+            int16 futilityScore = standpat + futilityMargin[depth];
+            if (futilityScore > currentMax)
+            {
+                currentMax = futilityScore;
+            }
+
+            ctx->futilityPrunes++;
+            continue;
+        }
+#endif
+
+        bool needFullDepthSearch = true;
+        int16 curScore = 0;
+
+#if USE_LATE_MOVE_REDUCTION == 1
+        // try late move reduction
+        // see http://www.glaurungchess.com/lmr.html for a good introduction to LMR
+
+        if (lateMoveReductions &&
+            picker.getStage() == MP_QUIETS &&                           // only non-TT, non-killer quiet moves are reduced
+            depth >= LMR_MIN_DEPTH &&                                   // we are at sufficient depth
+            movesSearched >= LMR_FULL_DEPTH_MOVES &&                    // sufficient no. of moves have been already searched at full depth
+            quietsSearched >= LMR_FULL_DEPTH_QUEIT_MOVES &&             // sufficient no. of quite moves have been searched at full depth
+            !inCheck &&                                                 // not in check
+            standpat - LMR_EVAL_THRESHOLD < alpha &&                    // static eval at the node is less than best move found (again doesn't seem to help)
+          //!(BIT(move.getFrom()) & bb.pawns) &&                        // don't reduce pawn pushes
+            !BitBoardUtils::IsInCheck(&newPos)                          // the move doesn't cause a check to opponent side
+            )
+        {
+            int reduction = getLMRReduction(depth, isPVNode, movesSearched, GetHistoryScore(ctx, pos, move, chance));
+
+            // search with reduced depth (also notice null-window - i.e, beta = alpha+1 as we are only interested in checking if the returned value is > alpha)
+            curScore = -alphabeta<!chance>(ctx, &newPos, newHash, newEvalState, depth - 1 - reduction, curPly + 1, -(alpha + 1), -alpha, true, move);
+            ctx->lmrReductions++;
+
+            // verify the moves that beat alpha with a full depth search
+            if (curScore <= alpha)
+            {
+                needFullDepthSearch = false;
+            }
+            else
+            {
+                ctx->lmrResearches++;
+            }
+        }
+#endif
+
+        if (needFullDepthSearch)
+        {
+            curScore = searchMove<chance>(ctx, &newPos, newHash, newEvalState, depth - 1, curPly + 1, alpha, beta, movesSearched == 0, move);
+        }
         curScore = adjustScoreForExtension(curScore, extendedDepth);
+        if (ctx->stop)
+            return 0;
+
+        movesSearched++;
 
         // update history tables if this was a non-capture move
-        if (!(ttMove.getFlags() & CM_FLAG_CAPTURE))
+        if (isQuiet)
         {
-            UpdateHistory(pos, ttMove, depth, chance, curScore >= beta);
+            quietsSearched++;
+            UpdateHistory(ctx, pos, move, depth, chance, curScore >= beta);
         }
 
         if (curScore >= beta)
         {
-            // update killer move table if this was a non-capture move
-            if (!(ttMove.getFlags() & CM_FLAG_CAPTURE))
+            // update killer table (or increase priority of the killer causing the cutoff)
+            if (isQuiet && ctx->killers[depth][0] != move)
             {
-                if (killers[depth][0] != ttMove)
-                {
-                    killers[depth][1] = killers[depth][0];
-                    killers[depth][0] = ttMove;
-                }
+                ctx->killers[depth][1] = ctx->killers[depth][0];
+                ctx->killers[depth][0] = move;
             }
 
-            TranspositionTable::update(hash, curScore, SCORE_GE, currentBestMove, depth, curPly);
+            TranspositionTable::update(hash, curScore, SCORE_GE, move, depth, curPly);
             return curScore;
         }
 
-        currentMax = curScore;
-        if (currentMax > alpha)
+        if (curScore > currentMax)
         {
-            alpha = currentMax;
-            improvedAlpha = true;
+            currentMax = curScore;
+            if (currentMax > alpha)
+            {
+                alpha = currentMax;
+                improvedAlpha = true;
+            }
+
+            currentBestMove = move;
         }
     }
 
-#if GATHER_STATS == 1
-    nonTTSearched++;
-#endif
-
-    // searched points to the index in newMoves list
-    // but we might have tried more moves than that (e.g from TT or killers)
-    int searched = 0;
-    int winingCaptures = 0;
-
-    // generate child nodes
-    CMove newMoves[MAX_MOVES];
-    int nMoves;
-
-    if (inCheck)
-    {
-        nMoves = BitBoardUtils::generateMovesOutOfCheck<chance>(&bb, newMoves);
-        winingCaptures = nMoves;
-    }
-    else
-    {
-        nMoves = BitBoardUtils::generateCaptures<chance>(&bb, newMoves);                // generate captures in MVV-LVA order
-
-
-#if USE_SEE_MOVE_ORDERING == 1
-        // sorting captures using SEE is overall a loss and sometimes even results in bigger tree! Bug?
-        // searching losing captures after quiet moves results in even bigger tree! Another bug?
-        if (depth >= MIN_DEPTH_FOR_SEE)
-        {
-            winingCaptures = SortCapturesSEE<chance>(pos, newMoves, nMoves);
-        }
-#endif
-
-#if SEARCH_LOSING_CAPTURES_AFTER_KILLERS == 0
-        winingCaptures = nMoves;
-#endif
-
-        // search captures first
-        for (int i = 0; i < winingCaptures; i++)
-        {
-            if (newMoves[i] != ttMove)
-            {
-                HexaBitBoardPosition newPos = *pos;
-                uint64 newHash = hash;
-                BitBoardUtils::MakeMove(&newPos, newHash, newMoves[i]);
-
-                movesSearched++;
-                int16 curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, newMoves[i]);
-                curScore = adjustScoreForExtension(curScore, extendedDepth);
-
-                if (curScore >= beta)
-                {
-                    TranspositionTable::update(hash, curScore, SCORE_GE, newMoves[i], depth, curPly);
-                    return curScore;
-                }
-
-                if (curScore > currentMax)
-                {
-                    currentMax = curScore;
-                    if (currentMax > alpha)
-                    {
-                        alpha = currentMax;
-                        improvedAlpha = true;
-                    }
-
-                    currentBestMove = newMoves[i];
-                }
-            }
-        }
-        searched = nMoves;
-
-        nMoves += BitBoardUtils::generateNonCaptures<chance>(&bb, &newMoves[nMoves]);   // then rest of the moves
-    }
-
-
-#if GATHER_STATS == 1
-    nonCaptureSearched++;
-#endif
-
     // special case: Check if it's checkmate or stalemate
-    if (nMoves == 0)
+    if (movesSearched == 0)
     {
         if (inCheck)
         {
@@ -624,190 +991,6 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
         }
     }
 
-    // try killers first
-    // also filter out killers and TT move from the list 
-    // TODO: no need to generate non captures if we get a cutoff on trying killer moves
-    //       need a move validity checker routine
-    for (int i = searched; i < nMoves; i++)
-    {
-        // filter TT moves
-        if (newMoves[i] == ttMove)
-        {
-            newMoves[i] = CMove();
-            continue;
-        }
-
-        bool isKiller = (killers[depth][0] == newMoves[i]) || 
-                        (killers[depth][1] == newMoves[i]);
-
-        if (isKiller)
-        {
-            HexaBitBoardPosition newPos = *pos;
-            uint64 newHash = hash;
-            BitBoardUtils::MakeMove(&newPos, newHash, newMoves[i]);
-
-            movesSearched++;
-            int16 curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, newMoves[i]);
-            curScore = adjustScoreForExtension(curScore, extendedDepth);
-
-            UpdateHistory(pos, newMoves[i], depth, chance, curScore >= beta);
-
-            if (curScore >= beta)
-            {
-                // increase priority of this killer
-                if (killers[depth][0] != newMoves[i])
-                {
-                    killers[depth][1] = killers[depth][0];
-                    killers[depth][0] = newMoves[i];
-                }
-
-                TranspositionTable::update(hash, curScore, SCORE_GE, newMoves[i], depth, curPly);
-                return curScore;
-            }
-
-            if (curScore > currentMax)
-            {
-                currentMax = curScore;
-                if (currentMax > alpha)
-                {
-                    alpha = currentMax;
-                    improvedAlpha = true;
-                }
-
-                currentBestMove = newMoves[i];
-            }
-
-            // filter out killers
-            newMoves[i] = CMove();
-        }
-    }
-
-#if GATHER_STATS == 1
-    nonKillersSearched++;
-#endif
-
-#if SEARCH_LOSING_CAPTURES_AFTER_KILLERS == 1
-    // search losing captures
-    for (int i = winingCaptures; i < searched; i++)
-    {
-        if (newMoves[i] != ttMove)
-        {
-            HexaBitBoardPosition newPos = *pos;
-            uint64 newHash = hash;
-            BitBoardUtils::MakeMove(&newPos, newHash, newMoves[i]);
-
-            movesSearched++;
-            int16 curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, newMoves[i]);
-            curScore = adjustScoreForExtension(curScore, extendedDepth);
-
-            if (curScore >= beta)
-            {
-                TranspositionTable::update(hash, curScore, SCORE_GE, newMoves[i], depth, curPly);
-                return curScore;
-            }
-
-            if (curScore > currentMax)
-            {
-                currentMax = curScore;
-                if (currentMax > alpha)
-                {
-                    alpha = currentMax;
-                    improvedAlpha = true;
-                }
-
-                currentBestMove = newMoves[i];
-            }
-        }
-    }
-#endif
-
-    // used for LMR
-#if USE_LATE_MOVE_REDUCTION == 1
-    int16 standpat = 0;
-    if (depth >= LMR_MIN_DEPTH)
-    {
-        standpat = BitBoardUtils::Evaluate(pos);
-    }
-#endif
-
-#if USE_HISTORY_HEURISTIC == 1
-    // sort non-captures based on history heuristic
-    if (depth >= HISTORY_SORT_MIN_DEPTH)
-    {
-        SortMovesHistory(pos, &newMoves[searched], nMoves - searched, chance);
-    }
-#endif
-
-    // try remaining moves (non capture, non TT and non-killer)
-    // searched == no. of captures when not in check, and 0 when in check
-    for (int i = searched; i < nMoves; i++)
-    {
-        if (newMoves[i].isValid())
-        {
-            HexaBitBoardPosition newPos = *pos;
-            uint64 newHash = hash;
-            BitBoardUtils::MakeMove(&newPos, newHash, newMoves[i]);
-
-            bool needFullDepthSearch = true;
-            int16 curScore = 0;
-
-#if USE_LATE_MOVE_REDUCTION == 1
-            // try late move reduction
-            // see http://www.glaurungchess.com/lmr.html for a good introduction to LMR
-
-            if (depth >= LMR_MIN_DEPTH &&                                   // we are at sufficient depth
-                movesSearched >= LMR_FULL_DEPTH_MOVES &&                    // sufficient no. of moves have been already searched at full depth
-                movesSearched - searched >= LMR_FULL_DEPTH_QUEIT_MOVES &&   // sufficient no. of quite moves have been searched at full depth
-                !inCheck &&                                                 // not in check
-              //!improvedAlpha &&                                           // this is not a PV node (makes engine significantly weaker!)
-                standpat - LMR_EVAL_THRESHOLD < alpha &&                    // static eval at the node is less than best move found (again doesn't seem to help)
-              //!(BIT(newMoves[i].getFrom()) & bb.pawns) &&                 // don't reduce pawn pushes
-                !BitBoardUtils::IsInCheck(&newPos)                          // the move doesn't cause a check to opponent side
-                )
-            {
-                // search with reduced depth (also notice null-window - i.e, beta = alpha+1 as we are only interested in checking if the returned value is > alpha)
-                curScore = -alphabeta<!chance>(&newPos, newHash, depth - 2 /*- getLMRReduction(depth, improvedAlpha, movesSearched)*/, curPly + 1, -(alpha + 1), -alpha, true, newMoves[i]);
-                if (curScore <= currentMax)
-                {
-                    needFullDepthSearch = false;
-                }
-            }
-#endif
-
-            if (needFullDepthSearch)
-            {
-                curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, newMoves[i]);
-            }
-            curScore = adjustScoreForExtension(curScore, extendedDepth);
-
-            movesSearched++;
-
-            UpdateHistory(pos, newMoves[i], depth, chance, curScore >= beta);
-
-            if (curScore >= beta)
-            {
-                // update killer table
-                killers[depth][1] = killers[depth][0];
-                killers[depth][0] = newMoves[i];
-
-                TranspositionTable::update(hash, curScore, SCORE_GE, newMoves[i], depth, curPly);
-                return curScore;
-            }
-
-            if (curScore > currentMax)
-            {
-                currentMax = curScore;
-                if (currentMax > alpha)
-                {
-                    alpha = currentMax;
-                    improvedAlpha = true;
-                }
-
-                currentBestMove = newMoves[i];
-            }
-        }
-    }
-
 
     // default node type is ALL node and the score returned is a upper bound on the score of the node
     if (improvedAlpha)
@@ -824,7 +1007,7 @@ int16 Game::alphabeta(HexaBitBoardPosition *pos, uint64 hash, int depth, int cur
     return currentMax;
 }
 
-void Game::GetPVFromTT(HexaBitBoardPosition *pos)
+void Game::GetPVFromTT(SearchContext *ctx, HexaBitBoardPosition *pos)
 {
     HexaBitBoardPosition nextPos = *pos;
 
@@ -838,9 +1021,9 @@ void Game::GetPVFromTT(HexaBitBoardPosition *pos)
         uint8 type;
         int hashDepth;
         bool foundInTT = TranspositionTable::lookup(posHash, 0, &score, &type, &hashDepth, &bestMove);
-        if (foundInTT && bestMove.isValid())
+        if (foundInTT && bestMove.isValid() && BitBoardUtils::IsLegalMove(&nextPos, bestMove))
         {
-            pv[depth++] = bestMove;
+            ctx->pv[depth++] = bestMove;
             BitBoardUtils::MakeMove(&nextPos, posHash, bestMove);
         }
         else
@@ -849,18 +1032,21 @@ void Game::GetPVFromTT(HexaBitBoardPosition *pos)
         }
     }
 
-    pvLen = depth;
+    ctx->pvLen = depth;
 }
 
 // root of alpha-beta search
 template<uint8 chance>
-int16 Game::alphabetaRoot(HexaBitBoardPosition *pos, int depth, int curPly)
+int16 Game::alphabetaRoot(SearchContext *ctx, HexaBitBoardPosition *pos, int depth, int curPly, int16 alpha, int16 beta)
 {
-    int16 alpha = -INF, beta = INF;
+    bool improvedAlpha = false;
     uint64 posHash = BitBoardUtils::ComputeZobristKey(pos);
 
+    EvalState evalState;
+    BitBoardUtils::ComputeEvalState(pos, &evalState);
+
     // used to detect draw by repetition
-    posHashes[curPly] = posHash;
+    ctx->posHashes[curPly] = posHash;
 
     // lookup in the transposition table
     int hashDepth = 0;
@@ -868,31 +1054,55 @@ int16 Game::alphabetaRoot(HexaBitBoardPosition *pos, int depth, int curPly)
     uint8 scoreType = 0;
     CMove ttMove = {};
     bool foundInTT = TranspositionTable::lookup(posHash, depth, &hashScore, &scoreType, &hashDepth, &ttMove);
+    if (ttMove.isValid() && !BitBoardUtils::IsLegalMove(pos, ttMove))
+    {
+        ttMove = CMove(0);
+    }
+
+    // no. of moves searched so far (all moves after the first one are searched with a null window first)
+    int searched = 0;
 
     CMove currentBestMove = ttMove;
     if (ttMove.isValid())
     {
         HexaBitBoardPosition newPos = *pos;
         uint64 newHash = posHash;
-        BitBoardUtils::MakeMove(&newPos, newHash, ttMove);
+        EvalState newEvalState = evalState;
+        BitBoardUtils::MakeMove(&newPos, newHash, newEvalState, ttMove);
 
-        int16 curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, ttMove);
+        int16 curScore = searchMove<chance>(ctx, &newPos, newHash, newEvalState, depth - 1, curPly + 1, alpha, beta, true, ttMove);
+
+        // aborted before even the first move could be searched (keep the best move from previous iteration)
+        if (ctx->stop)
+            return alpha;
 
         if (curScore > alpha)
         {
             alpha = curScore;
+            improvedAlpha = true;
+
+            // fail high (aspiration window is widened by the caller)
+            if (alpha >= beta)
+            {
+                TranspositionTable::update(posHash, alpha, SCORE_GE, currentBestMove, depth, curPly);
+                ctx->bestMove = currentBestMove;
+                return alpha;
+            }
         }
+        searched++;
     }
 
 
     ExpandedBitBoard bb = BitBoardUtils::ExpandBitBoard<chance>(pos);
-    int searched = 0;
     bool inCheck = !!(bb.threatened & bb.myKing);
 
     // generate child nodes
     CMove newMoves[MAX_MOVES];
     int nMoves;
 
+    // index of the first move not yet searched
+    int firstMove = 0;
+
     if (inCheck)
     {
         nMoves = BitBoardUtils::generateMovesOutOfCheck<chance>(&bb, newMoves);
@@ -913,84 +1123,197 @@ int16 Game::alphabetaRoot(HexaBitBoardPosition *pos, int depth, int curPly)
             {
                 HexaBitBoardPosition newPos = *pos;
                 uint64 newHash = posHash;
-                BitBoardUtils::MakeMove(&newPos, newHash, newMoves[i]);
+                EvalState newEvalState = evalState;
+                BitBoardUtils::MakeMove(&newPos, newHash, newEvalState, newMoves[i]);
+
+                int16 curScore = searchMove<chance>(ctx, &newPos, newHash, newEvalState, depth - 1, curPly + 1, alpha, beta, searched == 0, newMoves[i]);
+                searched++;
 
-                int16 curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, newMoves[i]);
+                // aborted: score of this move is not reliable - but the moves searched before this are
+                if (ctx->stop)
+                {
+                    if (improvedAlpha)
+                        ctx->bestMove = currentBestMove;
+                    return alpha;
+                }
 
                 if (curScore > alpha)
                 {
                     alpha = curScore;
+                    improvedAlpha = true;
                     currentBestMove = newMoves[i];
+
+                    if (alpha >= beta)
+                    {
+                        TranspositionTable::update(posHash, alpha, SCORE_GE, currentBestMove, depth, curPly);
+                        ctx->bestMove = currentBestMove;
+                        return alpha;
+                    }
                 }
 
                 // check if we are out of time.. and exit the search if so
-                uint64 timeElapsed = timer.stop();
-                if (timeElapsed > (searchTime / 1.01f))
+                uint64 timeElapsed = ctx->timer.stop();
+                if (timeElapsed > (ctx->searchTime / 1.01f))
                 {
-                    TranspositionTable::update(posHash, alpha, SCORE_GE, currentBestMove, depth, curPly);
-                    bestMove = currentBestMove;
+                    // the remaining moves are not searched: only a bound proven by some move can be stored
+                    if (improvedAlpha)
+                    {
+                        TranspositionTable::update(posHash, alpha, SCORE_GE, currentBestMove, depth, curPly);
+                        ctx->bestMove = currentBestMove;
+                    }
+                    ctx->stop = true;
                     return alpha;
                 }
             }
         }
-        searched = nMoves;
-
+        firstMove = nMoves;
         nMoves += BitBoardUtils::generateNonCaptures<chance>(&bb, &newMoves[nMoves]);   // then rest of the moves
     }
 
 
-    for (int i = searched; i < nMoves; i++)
+    for (int i = firstMove; i < nMoves; i++)
     {
         if (newMoves[i] != ttMove)
         {
             HexaBitBoardPosition newPos = *pos;
             uint64 newHash = posHash;
-            BitBoardUtils::MakeMove(&newPos, newHash, newMoves[i]);
+            EvalState newEvalState = evalState;
+            BitBoardUtils::MakeMove(&newPos, newHash, newEvalState, newMoves[i]);
+
+            int16 curScore = searchMove<chance>(ctx, &newPos, newHash, newEvalState, depth - 1, curPly + 1, alpha, beta, searched == 0, newMoves[i]);
+            searched++;
 
-            int16 curScore = -alphabeta<!chance>(&newPos, newHash, depth - 1, curPly + 1, -beta, -alpha, true, newMoves[i]);
+            if (ctx->stop)
+            {
+                if (improvedAlpha)
+                    ctx->bestMove = currentBestMove;
+                return alpha;
+            }
 
             if (curScore > alpha)
             {
                 alpha = curScore;
+                improvedAlpha = true;
                 currentBestMove = newMoves[i];
+
+                if (alpha >= beta)
+                {
+                    TranspositionTable::update(posHash, alpha, SCORE_GE, currentBestMove, depth, curPly);
+                    ctx->bestMove = currentBestMove;
+                    return alpha;
+                }
             }
 
             // check if we are out of time.. and exit the search if so
-            uint64 timeElapsed = timer.stop();
-            if (timeElapsed > (searchTime / 1.01f))
+            uint64 timeElapsed = ctx->timer.stop();
+            if (timeElapsed > (ctx->searchTime / 1.01f))
             {
-                TranspositionTable::update(posHash, alpha, SCORE_GE, currentBestMove, depth, curPly);
-                bestMove = currentBestMove;
+                // the remaining moves are not searched: only a bound proven by some move can be stored
+                if (improvedAlpha)
+                {
+                    TranspositionTable::update(posHash, alpha, SCORE_GE, currentBestMove, depth, curPly);
+                    ctx->bestMove = currentBestMove;
+                }
+                ctx->stop = true;
                 return alpha;
             }
 
         }
     }
 
-    TranspositionTable::update(posHash, alpha, SCORE_EXACT, currentBestMove, depth, curPly);
+    // fail low: all moves are worse than alpha (the best move from previous iteration is retained)
+    TranspositionTable::update(posHash, alpha, improvedAlpha ? SCORE_EXACT : SCORE_LE, currentBestMove, depth, curPly);
 
-    bestMove = currentBestMove;
+    // every thread records its own best move (the move played is the main thread's, see GetBestMove)
+    // the best move is updated only if some move improved alpha, otherwise the one from the previous iteration
+    // (or from the previous aspiration window) is kept
+    if (improvedAlpha)
+        ctx->bestMove = currentBestMove;
 
     return alpha;
 }
 
+// one iteration of iterative deepening
+// searched with an aspiration window around the score of previous iteration, the window is widened
+// (only on the side that failed) and the position is searched again till the score falls inside it
+int16 Game::searchRoot(SearchContext *ctx, HexaBitBoardPosition *pos, int depth, int ply, int16 prevScore)
+{
+    int alpha = -INF, beta = INF;
+    int delta = ASPIRATION_WINDOW;
 
+#if USE_ASPIRATION_WINDOWS == 1
+    if (depth >= MIN_DEPTH_FOR_ASPIRATION && abs(prevScore) < MATE_SCORE_BASE / 2)
+    {
+        alpha = prevScore - delta;
+        beta  = prevScore + delta;
+    }
+#endif
+
+    while (true)
+    {
+        int16 score;
+        if (pos->chance == WHITE)
+            score = alphabetaRoot<WHITE>(ctx, pos, depth, ply, alpha, beta);
+        else
+            score = alphabetaRoot<BLACK>(ctx, pos, depth, ply, alpha, beta);
+
+        // aborted (stopped or out of time) in the middle of the iteration, the score is not usable
+        if (ctx->stop)
+            return score;
+
+        bool failLow  = score <= alpha && alpha > -INF;
+        bool failHigh = score >= beta  && beta  <  INF;
+        if (!failLow && !failHigh)
+            return score;
+
+        // no time left to re-search with a wider window
+        if (ctx->timer.stop() > (ctx->searchTime / 1.01f))
+        {
+            ctx->stop = true;
+            return score;
+        }
+
+        delta *= 2;
+        if (failLow)
+        {
+            alpha = score - delta;
+            if (alpha < -INF)
+                alpha = -INF;
+        }
+        else
+        {
+            beta = score + delta;
+            if (beta > INF)
+                beta = INF;
+        }
+    }
+}
+
+
+
+template int16 Game::alphabeta<WHITE>(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int curPly, int16 alpha, int16 beta, bool tryNullMove, CMove lastMove);
+template int16 Game::alphabeta<BLACK>(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int curPly, int16 alpha, int16 beta, bool tryNullMove, CMove lastMove);
 
-template int16 Game::alphabeta<WHITE>(HexaBitBoardPosition *pos, uint64 hash, int depth, int curPly, int16 alpha, int16 beta, bool tryNullMove, CMove lastMove);
-template int16 Game::alphabeta<BLACK>(HexaBitBoardPosition *pos, uint64 hash, int depth, int curPly, int16 alpha, int16 beta, bool tryNullMove, CMove lastMove);
 
+template int16 Game::alphabetaRoot<WHITE>(SearchContext *ctx, HexaBitBoardPosition *pos, int depth, int curPly, int16 alpha, int16 beta);
+template int16 Game::alphabetaRoot<BLACK>(SearchContext *ctx, HexaBitBoardPosition *pos, int depth, int curPly, int16 alpha, int16 beta);
 
-template int16 Game::alphabetaRoot<WHITE>(HexaBitBoardPosition *pos, int depth, int curPly);
-template int16 Game::alphabetaRoot<BLACK>(HexaBitBoardPosition *pos, int depth, int curPly);
+template int16 Game::searchMove<WHITE>(SearchContext *ctx, HexaBitBoardPosition *newPos, uint64 newHash, const EvalState &newEvalState, int depth, int curPly, int16 alpha, int16 beta, bool firstMove, CMove move);
+template int16 Game::searchMove<BLACK>(SearchContext *ctx, HexaBitBoardPosition *newPos, uint64 newHash, const EvalState &newEvalState, int depth, int curPly, int16 alpha, int16 beta, bool firstMove, CMove move);
 
-template int16 Game::q_search<WHITE>(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 alpha, int16 beta, int curPly);
-template int16 Game::q_search<BLACK>(HexaBitBoardPosition *pos, uint64 hash, int depth, int16 alpha, int16 beta, int curPly);
+template class MovePicker<WHITE>;
+template class MovePicker<BLACK>;
+
+template int16 Game::q_search<WHITE>(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int16 alpha, int16 beta, int curPly);
+template int16 Game::q_search<BLACK>(SearchContext *ctx, HexaBitBoardPosition *pos, uint64 hash, const EvalState &evalState, int depth, int16 alpha, int16 beta, int curPly);
 
 
 
 
 // transposition table related stuff
-#if USE_DUAL_SLOT_TT == 1
+#if USE_DUAL_SLOT_TT == 1 && USE_LOCKLESS_TT == 1
+LocklessTTEntry* TranspositionTable::TT;     // the transposition table
+#elif USE_DUAL_SLOT_TT == 1
 DualTTEntry* TranspositionTable::TT;         // the transposition table
 #else
 TTEntry* TranspositionTable::TT;         // the transposition table
@@ -1000,45 +1323,197 @@ uint64   TranspositionTable::indexBits;  // bits of hash key used for the index
 uint64   TranspositionTable::hashBits;   // bits of hash key used for the hash part in hash table (size-1)
 
 uint64* TranspositionTable::qTT;         // transposition table for q-search
+uint64  TranspositionTable::qIndexBits;
+uint64  TranspositionTable::qHashBits;
+
+uint64  TranspositionTable::byteSize  = DEAFULT_TT_SIZE;
+uint64  TranspositionTable::qByteSize = DEFAULT_Q_TT_SIZE;
+
+uint8   TranspositionTable::pageMode;
+uint8   TranspositionTable::qPageMode;
 
+uint64* TranspositionTable::evalCache;   // cache of static evaluation scores
+uint64  TranspositionTable::evalIndexBits;
+uint64  TranspositionTable::evalByteSize = DEFAULT_EVAL_CACHE_SIZE;
+uint8   TranspositionTable::evalPageMode;
 
-void  TranspositionTable::init(int byteSize)
+PerftTTEntry* TranspositionTable::perftTT;   // transposition table for hashed perft
+uint64  TranspositionTable::perftIndexBits;
+uint64  TranspositionTable::perftByteSize = DEFAULT_PERFT_TT_SIZE;
+uint8   TranspositionTable::perftPageMode;
+
+// largest power of two <= x
+static uint64 floorPowerOfTwo(uint64 x)
 {
-#if USE_DUAL_SLOT_TT == 1
-    size  = byteSize / sizeof(DualTTEntry);
-    TT = (DualTTEntry *) malloc(byteSize);
-#else
-    size  = byteSize / sizeof(TTEntry);
-    TT = (TTEntry *) malloc(byteSize);
-#endif
+    uint64 p = 1;
+    while (p <= x / 2)
+        p *= 2;
+    return p;
+}
+
+// allocate one of the hash tables with the given no. of elements
+// if that fails (e.g, the size set by a uci option is too big), fallbackElements and then minElements are tried
+// elements is updated with the size actually allocated
+static void *allocTable(const char *name, uint64 *elements, uint64 fallbackElements, uint64 minElements, uint64 elementSize, uint8 *pageMode)
+{
+    uint64 tries[] = { *elements, fallbackElements, minElements };
+    uint64 failedElements = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        // no point trying a size that isn't smaller than the one that already failed
+        if (failedElements && tries[i] >= failedElements)
+            continue;
+
+        void *mem = Utils::LargePageAlloc(tries[i] * elementSize, pageMode);
+        if (mem)
+        {
+            if (failedElements)
+            {
+                printf("info string failed to allocate %llu KB for the %s, using %llu KB\n", *elements * elementSize / 1024,
+                       name, tries[i] * elementSize / 1024);
+                fflush(stdout);
+            }
+            *elements = tries[i];
+            return mem;
+        }
+        failedElements = tries[i];
+    }
+
+    printf("info string out of memory allocating the %s\n", name);
+    fflush(stdout);
+    exit(1);
+}
+
+void  TranspositionTable::init()
+{
+    // in case the new size can't be allocated, go back to the size we had
+    uint64 prevSize     = TT ? size : floorPowerOfTwo(DEAFULT_TT_SIZE / sizeof(*TT));
+    uint64 prevQSize    = TT ? qIndexBits + 1 : Q_TT_ELEMENTS;
+    uint64 prevEvalSize = TT ? evalIndexBits + 1 : floorPowerOfTwo(DEFAULT_EVAL_CACHE_SIZE / sizeof(uint64));
+
+    destroy();
+
+    size = floorPowerOfTwo(byteSize / sizeof(*TT));
+    if (size < MIN_TT_ELEMENTS)
+        size = MIN_TT_ELEMENTS;
+    TT = (decltype(TT)) allocTable("hash table", &size, prevSize, MIN_TT_ELEMENTS, sizeof(*TT), &pageMode);
+    byteSize = size * sizeof(*TT);
 
     indexBits = size - 1;
     hashBits  = ALLSET ^ indexBits;
 
-    qTT = (uint64 *) malloc(sizeof(uint64) * Q_TT_ELEMENTS);
+    uint64 qSize = floorPowerOfTwo(qByteSize / sizeof(uint64));
+    if (qSize < Q_TT_ELEMENTS)
+        qSize = Q_TT_ELEMENTS;
+    qTT = (uint64 *) allocTable("q-search hash table", &qSize, prevQSize, Q_TT_ELEMENTS, sizeof(uint64), &qPageMode);
+    qByteSize = qSize * sizeof(uint64);
+
+    qIndexBits = qSize - 1;
+    qHashBits  = ALLSET ^ qIndexBits;
+
+    uint64 evalSize = floorPowerOfTwo(evalByteSize / sizeof(uint64));
+    if (evalSize < EVAL_CACHE_MIN_ELEMENTS)
+        evalSize = EVAL_CACHE_MIN_ELEMENTS;
+    evalCache = (uint64 *) allocTable("eval cache", &evalSize, prevEvalSize, EVAL_CACHE_MIN_ELEMENTS, sizeof(uint64), &evalPageMode);
+    evalByteSize = evalSize * sizeof(uint64);
+
+    evalIndexBits = evalSize - 1;
 
     reset();
 }
 
 void  TranspositionTable::destroy()
 {
-    free (TT);
-    free(qTT);
+    if (TT)
+        Utils::LargePageFree(TT, size * sizeof(*TT), pageMode);
+    if (qTT)
+        Utils::LargePageFree(qTT, (qIndexBits + 1) * sizeof(uint64), qPageMode);
+    if (evalCache)
+        Utils::LargePageFree(evalCache, (evalIndexBits + 1) * sizeof(uint64), evalPageMode);
+    TT = NULL;
+    qTT = NULL;
+    evalCache = NULL;
+}
+
+void  TranspositionTable::setSize(uint64 bytes)
+{
+    byteSize = bytes;
+    if (TT)
+        init();
+}
+
+void  TranspositionTable::setQSize(uint64 bytes)
+{
+    qByteSize = bytes;
+    if (TT)
+        init();
+}
+
+void  TranspositionTable::setEvalCacheSize(uint64 bytes)
+{
+    evalByteSize = bytes;
+    if (TT)
+        init();
 }
 
 void  TranspositionTable::reset()
 {
-#if USE_DUAL_SLOT_TT == 1
-    memset(TT, 0, size * sizeof(DualTTEntry));
-#else
-    memset(TT, 0, size * sizeof(TTEntry));
-#endif
-    memset(qTT, 0, Q_TT_ELEMENTS * sizeof(uint64));
+    memset(TT, 0, size * sizeof(*TT));
+    memset(qTT, 0, (qIndexBits + 1) * sizeof(uint64));
+    memset(evalCache, 0, (evalIndexBits + 1) * sizeof(uint64));
+}
+
+#if USE_LOCKLESS_TT == 1
+bool TranspositionTable::readSlot(const LocklessTTSlot *slot, uint64 hash, LocklessTTSlot *out)
+{
+    // read each word exactly once - other threads might be writing to the slot at the same time
+    const volatile uint64 *words = (const volatile uint64 *) slot;
+    out->key  = words[0];
+    out->data = words[1];
+
+    return (out->key ^ out->data) == hash;
+}
+
+void TranspositionTable::writeSlot(LocklessTTSlot *slot, uint64 hash, const LocklessTTSlot &in)
+{
+    volatile uint64 *words = (volatile uint64 *) slot;
+    words[0] = hash ^ in.data;
+    words[1] = in.data;
 }
+#endif
 
 bool TranspositionTable::lookup(uint64 hash, int searchDepth, int16 *score, uint8 *scoreType, int *foundDepth, CMove *bestMove)
 {
-#if USE_DUAL_SLOT_TT == 1
+#if USE_DUAL_SLOT_TT == 1 && USE_LOCKLESS_TT == 1
+
+    LocklessTTEntry *entry = &TT[hash & indexBits];
+    LocklessTTSlot slot;
+
+    // check deepest first and then most recent
+    if (!readSlot(&entry->deepest, hash, &slot) &&
+        !readSlot(&entry->mostRecent, hash, &slot))
+    {
+        return false;
+    }
+
+    *score      = slot.score;
+    *scoreType  = slot.scoreType;
+    *foundDepth = slot.depth;
+    *bestMove   = CMove(slot.bestMove);
+
+    // adjust mate score
+    if (abs(*score) >= MATE_SCORE_BASE / 2)
+    {
+        if ((*score) < 0)
+            *score = (*score) - searchDepth;
+        else
+            *score = (*score) + searchDepth;
+    }
+
+    return true;
+
+#elif USE_DUAL_SLOT_TT == 1
 
     DualTTEntry *entry = &TT[hash & indexBits];
 
@@ -1115,7 +1590,34 @@ void TranspositionTable::update(uint64 hash, int16 score, uint8 scoreType, CMove
             score = score - depth;
     }
 
-#if USE_DUAL_SLOT_TT == 1
+#if USE_DUAL_SLOT_TT == 1 && USE_LOCKLESS_TT == 1
+    LocklessTTEntry *entry = &TT[hash & indexBits];
+
+    LocklessTTSlot slot;
+    slot.data = 0;
+    slot.bestMove  = bestMove.getVal();
+    slot.score     = score;
+    slot.scoreType = scoreType;
+    slot.depth     = depth;
+    slot.age       = Game::GetIrReversibleRefCount();
+
+    // the deepest slot might be getting updated by another thread
+    // reading a torn value is harmless here - it only affects the replacement decision
+    LocklessTTSlot deepest;
+    readSlot(&entry->deepest, 0, &deepest);
+
+    // try putting it in deepest slot if possible
+    if (depth >= deepest.depth ||                                           // either entry is deeper than what is stored
+        abs(Game::GetIrReversibleRefCount() - deepest.age) >= 2)           // or what is stored is too old (2 more more ir-reversible moves made)
+    {
+        writeSlot(&entry->deepest, hash, slot);
+    }
+    else
+    {
+        // put it in most recent slot
+        writeSlot(&entry->mostRecent, hash, slot);
+    }
+#elif USE_DUAL_SLOT_TT == 1
     DualTTEntry *entry = &TT[hash & indexBits];
 
     // try putting it in deepest slot if possible
@@ -1160,14 +1662,16 @@ void TranspositionTable::update(uint64 hash, int16 score, uint8 scoreType, CMove
 
 
 
+// q-search TT entries are a single 64 bit word (hash bits and data packed together)
+// aligned 64 bit loads/stores are atomic, so they are safe to share between threads as is
 bool TranspositionTable::lookup_q(uint64 hash, int16 *eval, uint8 *scoreType)
 {
 #if USE_Q_TT == 1
-    uint64 fromTT = qTT[hash & Q_TT_INDEX_BITS];
+    uint64 fromTT = qTT[hash & qIndexBits];
 
-    if ((fromTT & Q_TT_HASH_BITS) == (hash & Q_TT_HASH_BITS))
+    if ((fromTT & qHashBits) == (hash & qHashBits))
     {
-        uint32 retVal = fromTT & Q_TT_INDEX_BITS;
+        uint32 retVal = fromTT & qIndexBits;
         *eval = (retVal & 0xFFFF);
         *scoreType = ((retVal >> 16) & 0x3);
 
@@ -1181,7 +1685,77 @@ void  TranspositionTable::update_q(uint64 hash, int16 eval, uint8 scoreType)
 {
 #if USE_Q_TT == 1
     uint32 storedval = (eval & 0xFFFF) | ((scoreType << 16) & 0x30000);
-    uint64 toTT = (hash & Q_TT_HASH_BITS) | (storedval & Q_TT_INDEX_BITS);
-    qTT[hash & Q_TT_INDEX_BITS] = toTT;
+    uint64 toTT = (hash & qHashBits) | (storedval & qIndexBits);
+    qTT[hash & qIndexBits] = toTT;
 #endif
 }
+
+// eval cache entries are packed the same way as q-search TT entries
+// the index bits are at least 16, so the 16 LSBs of hash key (which are always part of the index) hold the score
+bool TranspositionTable::lookup_eval(uint64 hash, int16 *eval)
+{
+    uint64 fromCache = evalCache[hash & evalIndexBits];
+
+    if ((fromCache ^ hash) & ~0xFFFFull)
+        return false;
+
+    *eval = (int16) (fromCache & 0xFFFF);
+    return true;
+}
+
+void  TranspositionTable::update_eval(uint64 hash, int16 eval)
+{
+    evalCache[hash & evalIndexBits] = (hash & ~0xFFFFull) | (uint16) eval;
+}
+
+
+void  TranspositionTable::initPerft()
+{
+    // in case the new size can't be allocated, go back to the size we had
+    uint64 prevSize = perftTT ? perftIndexBits + 1 : floorPowerOfTwo(DEFAULT_PERFT_TT_SIZE / sizeof(PerftTTEntry));
+
+    if (perftTT)
+        Utils::LargePageFree(perftTT, getPerftSize(), perftPageMode);
+
+    uint64 perftSize = floorPowerOfTwo(perftByteSize / sizeof(PerftTTEntry));
+    if (perftSize < MIN_TT_ELEMENTS)
+        perftSize = MIN_TT_ELEMENTS;
+    perftTT = (PerftTTEntry *) allocTable("perft hash table", &perftSize, prevSize, MIN_TT_ELEMENTS, sizeof(PerftTTEntry), &perftPageMode);
+    perftByteSize = perftSize * sizeof(PerftTTEntry);
+    perftIndexBits = perftSize - 1;
+    memset(perftTT, 0, perftSize * sizeof(PerftTTEntry));
+}
+
+void  TranspositionTable::setPerftSize(uint64 bytes)
+{
+    perftByteSize = bytes;
+    if (perftTT)
+        initPerft();
+}
+
+// perft counts at different depths of the same position are stored in different slots (hash ^ zob.depth[depth])
+bool TranspositionTable::lookup_perft(uint64 hash, int depth, uint64 *count)
+{
+    uint64 key = hash ^ BitBoardUtils::zob.depth[depth];
+
+    // read each word exactly once - other threads might be writing to the entry at the same time
+    const volatile uint64 *words = (const volatile uint64 *) &perftTT[key & perftIndexBits];
+    uint64 entryKey   = words[0];
+    uint64 entryCount = words[1];
+
+    if ((entryKey ^ entryCount) == key)
+    {
+        *count = entryCount;
+        return true;
+    }
+    return false;
+}
+
+void  TranspositionTable::update_perft(uint64 hash, int depth, uint64 count)
+{
+    uint64 key = hash ^ BitBoardUtils::zob.depth[depth];
+
+    volatile uint64 *words = (volatile uint64 *) &perftTT[key & perftIndexBits];
+    words[0] = key ^ count;
+    words[1] = count;
+}
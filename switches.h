@@ -35,6 +35,32 @@
 // >10% slower than fixed shift fancy magics on both CPU and GPU
 #define USE_BYTE_LOOKUP_FANCY 0
 
+// select the sliding piece attack backend (PEXT, fancy magics or plain magics) at startup
+// based on CPUID, so that the same binary is fast on every CPU.
+// USE_FANCY_MAGICS and USE_BYTE_LOOKUP_FANCY are ignored when this is enabled (x64 only)
+// the SIMD kogge-stone paths for attacked squares/pinned pieces are also selected at runtime
+// (see SetSimdAttackMode, and the 'attackbench' command for comparison with magics)
+#if defined(__x86_64__) || defined(_M_X64)
+#define USE_RUNTIME_SLIDING_DISPATCH 1
+#else
+#define USE_RUNTIME_SLIDING_DISPATCH 0
+#endif
+
+// AVX-512 intrinsics need visual studio 2017 (15.3) or newer
+#if defined(_MSC_VER) && _MSC_VER < 1911
+#define USE_AVX512_ATTACKS 0
+#else
+#define USE_AVX512_ATTACKS 1
+#endif
+
+// count moves of the children of perft depth-2 nodes 4 (AVX2) or 8 (AVX-512) positions at a time
+// (follows the SimdAttacks setting). Written using gcc/clang vector extensions so not available with msvc.
+#if USE_RUNTIME_SLIDING_DISPATCH == 1 && defined(__GNUC__)
+#define USE_BATCHED_MOVE_COUNT 1
+#else
+#define USE_BATCHED_MOVE_COUNT 0
+#endif
+
 
 #define INCREMENTAL_ZOBRIST_UPDATE 1
 
@@ -56,6 +82,15 @@
 // doesn't seem to help much (or at all ?)
 #define USE_Q_TT 1
 
+// principal variation search: search all but the first move with a null window first
+#define USE_PVS 1
+
+// search the root with a window of +/- ASPIRATION_WINDOW centipawns around the score of previous iteration
+// the window is doubled on every fail high/low
+#define USE_ASPIRATION_WINDOWS 1
+#define ASPIRATION_WINDOW 50
+#define MIN_DEPTH_FOR_ASPIRATION 4
+
 // min depth to engage IID (internal iterative deepening)
 // using IID near horizon can cause lot of extra overhead
 #define MIN_DEPTH_FOR_IID 5
@@ -64,9 +99,17 @@
 // every entry (of 192 bits/24 bytes) has one deepest and one most-recent slot
 #define USE_DUAL_SLOT_TT 1
 
+// use thread safe (lockless) dual slot TT
+// every slot stores (hash ^ data) and data, so that entries torn by concurrent writes from multiple threads fail the hash check
+// each entry is 256 bits/32 bytes (deepest and most-recent slots of 128 bits each)
+#define USE_LOCKLESS_TT 1
+
 
 // 16 million slots is default TT size
-#if USE_DUAL_SLOT_TT == 1
+#if USE_DUAL_SLOT_TT == 1 && USE_LOCKLESS_TT == 1
+// 256 MB 
+#define DEAFULT_TT_SIZE (256*1024*1024)
+#elif USE_DUAL_SLOT_TT == 1
 // 192 MB 
 #define DEAFULT_TT_SIZE (192*1024*1024)
 #else
@@ -74,9 +117,36 @@
 #define DEAFULT_TT_SIZE (256*1024*1024)
 #endif
 
+// no. of nodes after which the search checks for timeout
+// (~1 ms at 1 million nodes per second per thread)
+#define STOP_CHECK_INTERVAL 1024
+
+// default ply at which the tree is split into work items for parallel perft
+#define DEFAULT_PERFT_SPLIT_PLY 2
+
+// default search depth used by "bench" command
+#define DEFAULT_BENCH_DEPTH 7
+
+// default no. of passes over the position set made by "attackbench" command
+#define DEFAULT_ATTACK_BENCH_ITERATIONS 200
+
+// default no. of random games (and max length of each game) used to collect positions for the "seebench" command
+#define DEFAULT_SEE_BENCH_GAMES 1000
+#define SEE_BENCH_GAME_LENGTH 80
+
+// default no. of passes over the captures made by "seebench" command
+#define DEFAULT_SEE_BENCH_ITERATIONS 20
+
+// max size of TT (in MB) that can be set using the uci "Hash" option (256 GB)
+#define MAX_TT_SIZE_MB (256*1024)
+
 // no of killer moves per level
 #define MAX_KILLERS 2
 
+// max no of threads used by the (lazy SMP) parallel search
+// helper threads share the transposition table and search the same root position
+#define MAX_SEARCH_THREADS 64
+
 // use SEE for move ordering - doesn't seem to help
 // computing and sorting moves based on SEE adds more cost than benefit of SEE
 #define USE_SEE_MOVE_ORDERING 1
@@ -85,15 +155,31 @@
 // slows down search quite a bit (increasing tree size considerably).. why ?
 #define SEARCH_LOSING_CAPTURES_AFTER_KILLERS 0
 
-// prune bad captures (based on SEE) out of q-search
-// again seems to hurt a lot
-// TODO: figure out if SEE routine is really bug-free :-/
-#define USE_Q_SEARCH_SEE_PRUNING 0
+// use the swap list SEE (EvaluateSEEFast) instead of the one that makes the moves on a copy of the board
+// ~3x faster, but ignores pins (verified using the "seebench" command)
+#define USE_FAST_SEE 1
+
+// prune losing captures (based on SEE) out of q-search, and search the rest in SEE order
+// (used to hurt a lot when equal captures were also pruned and the slow SEE was used)
+#define USE_Q_SEARCH_SEE_PRUNING 1
+
+// delta pruning: skip q-search captures that can't bring the score back up to alpha even after winning
+// the captured piece (and the promotion) with some safety margin (can be changed using uci options)
+#define USE_DELTA_PRUNING 1
+#define DEFAULT_DELTA_PRUNING_MARGIN 200
 
 
 // use late move reductions (LMR)
-// TODO: without proper ordering of non capture moves, LMR doesn't seem to work well (or work at all)
-#define USE_LATE_MOVE_REDUCTION 0
+// reductions are looked up from a table indexed by depth and move number (separate for PV and non-PV nodes)
+// can be turned off at runtime using the LateMoveReductions uci option
+#define USE_LATE_MOVE_REDUCTION 1
+
+// size of the reduction table (larger depths and move numbers use the last entry)
+#define LMR_TABLE_DEPTH 64
+#define LMR_TABLE_MOVES 64
+
+// reduce one ply less for quiet moves with history score (ratio of cutoffs to tries) above this
+#define LMR_GOOD_HISTORY 0.5f
 
 // search at least these many moves at full depth
 #define LMR_FULL_DEPTH_MOVES 4
@@ -107,6 +193,14 @@
 #define LMR_MIN_DEPTH 3
 
 
+// static eval based pruning near the horizon (at non-PV nodes of depth <= STATIC_PRUNING_MAX_DEPTH)
+// margins are in tables in search.cpp, each technique can be turned off at runtime using uci options
+#define USE_FUTILITY_PRUNING 1
+#define USE_REVERSE_FUTILITY_PRUNING 1
+#define USE_RAZORING 1
+#define STATIC_PRUNING_MAX_DEPTH 3
+
+
 // try history heuristic to order moves correctly
 // helps some positions quite a bit (like start pos) - doesn't help others at all (like pos2 of cpw)
 // https://chessprogramming.wikispaces.com/History+Heuristic
@@ -118,9 +212,27 @@
 // using common history table is a tiny bit faster (and results in a slightly smaller tree too)
 #define HISTORY_PER_PIECE 0
 
+// cache pawn structure evaluation in a per-thread pawn hash table
+// no of entries must be a power of 2 (each entry is 32 bytes)
+#define USE_PAWN_HASH 1
+#define PAWN_HASH_ENTRIES (16 * 1024)
+
+// cache static evaluation scores in a (shared) hash table indexed by the zobrist key
+// size of the table is set using the EvalCache uci option
+#define USE_EVAL_CACHE 1
+
+// lazy eval: skip mobility and pawn structure eval when material and piece-square scores
+// alone are outside the q-search window by more than the margin (can be changed using uci options)
+#define USE_LAZY_EVAL 1
+#define DEFAULT_LAZY_EVAL_MARGIN 250
+
 // debugging switches
 #define GATHER_STATS 0
 
+// check the incrementally updated eval state (pawn hash, material, piece-square scores) against
+// the one computed from scratch after every move (only in debug builds)
+#define VERIFY_EVAL_STATE 1
+
 // promotion extension
 // extend depth by 1 ply when pawn reaches the second last rank (i.e, rank 7 for white and rank 2 for black)
 // doesn't seem to help much (or at all)
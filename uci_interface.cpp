@@ -1,4 +1,5 @@
 #include "chess.h"
+#include <climits>
 // UCI Interfacing routines
 
 void UciInterface::Search_Go(char *params) 
@@ -85,6 +86,328 @@ void UciInterface::Search_Go(char *params)
 
 }
 
+void UciInterface::SetOption(char *params)
+{
+    char *str;
+
+    // option value (all our options except SlidingAttacks, SimdAttacks and the check options are integers)
+    int value = 0;
+    str = strstr(params, "value");
+    if (!str)
+    {
+        return;
+    }
+    str += 6;
+    sscanf(str, "%d", &value);
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+    if (strstr(params, "name SlidingAttacks"))
+    {
+        if (Game::searching)
+            return;
+
+        uint8 mode = BitBoardUtils::GetDefaultSlidingAttackMode();
+        if (strstr(str, "pext"))
+            mode = SLIDING_ATTACKS_PEXT;
+        else if (strstr(str, "fancy"))
+            mode = SLIDING_ATTACKS_FANCY_MAGICS;
+        else if (strstr(str, "plain"))
+            mode = SLIDING_ATTACKS_PLAIN_MAGICS;
+
+        if (!BitBoardUtils::SetSlidingAttackMode(mode))
+        {
+            printf("info string %s not supported by this CPU\n", BitBoardUtils::SlidingAttackModeName(mode));
+        }
+        printf("info string sliding attacks using %s\n", BitBoardUtils::SlidingAttackModeName(BitBoardUtils::GetSlidingAttackMode()));
+    }
+    else if (strstr(params, "name SimdAttacks"))
+    {
+        if (Game::searching)
+            return;
+
+        uint8 mode = BitBoardUtils::GetDefaultSimdAttackMode();
+        if (strstr(str, "off"))
+            mode = SIMD_ATTACKS_NONE;
+        else if (strstr(str, "avx512"))
+            mode = SIMD_ATTACKS_AVX512;
+        else if (strstr(str, "avx2"))
+            mode = SIMD_ATTACKS_AVX2;
+
+        if (!BitBoardUtils::SetSimdAttackMode(mode))
+        {
+            printf("info string %s not supported by this CPU\n", BitBoardUtils::SimdAttackModeName(mode));
+        }
+        printf("info string simd attacks %s\n", BitBoardUtils::SimdAttackModeName(BitBoardUtils::GetSimdAttackMode()));
+    }
+    else
+#endif
+    if (strstr(params, "name Threads"))
+    {
+        // can't change no. of threads while search is in progress
+        if (Game::searching)
+            return;
+
+        Game::SetNumThreads(value);
+    }
+    else if (strstr(params, "name PerftHash"))
+    {
+        TranspositionTable::setPerftSize((uint64) value * 1024 * 1024);
+    }
+    else if (strstr(params, "name QSearchHash"))
+    {
+        if (Game::searching)
+            return;
+
+        TranspositionTable::setQSize((uint64) value * 1024 * 1024);
+        if (TranspositionTable::isAllocated())
+        {
+            printf("info string q-search hash table size %llu KB, using %s\n", TranspositionTable::getQSize() / 1024, Utils::PageModeName(TranspositionTable::getQPageMode()));
+        }
+    }
+    else if (strstr(params, "name ReverseFutilityPruning"))
+    {
+        Game::SetReverseFutilityPruning(strstr(str, "true") != NULL);
+    }
+    else if (strstr(params, "name FutilityPruning"))
+    {
+        Game::SetFutilityPruning(strstr(str, "true") != NULL);
+    }
+    else if (strstr(params, "name Razoring"))
+    {
+        Game::SetRazoring(strstr(str, "true") != NULL);
+    }
+#if USE_LATE_MOVE_REDUCTION == 1
+    else if (strstr(params, "name LateMoveReductions"))
+    {
+        Game::SetLateMoveReductions(strstr(str, "true") != NULL);
+    }
+#endif
+#if USE_LAZY_EVAL == 1
+    else if (strstr(params, "name LazyEvalMargin"))
+    {
+        Game::SetLazyEvalMargin(value);
+    }
+    else if (strstr(params, "name LazyEval"))
+    {
+        Game::SetLazyEval(strstr(str, "true") != NULL);
+    }
+#endif
+#if USE_DELTA_PRUNING == 1
+    else if (strstr(params, "name DeltaPruningMargin"))
+    {
+        Game::SetDeltaPruningMargin(value);
+    }
+    else if (strstr(params, "name DeltaPruning"))
+    {
+        Game::SetDeltaPruning(strstr(str, "true") != NULL);
+    }
+#endif
+    else if (strstr(params, "name EvalCache"))
+    {
+        if (Game::searching)
+            return;
+
+        TranspositionTable::setEvalCacheSize((uint64) value * 1024 * 1024);
+        if (TranspositionTable::isAllocated())
+        {
+            printf("info string eval cache size %llu KB, using %s\n", TranspositionTable::getEvalCacheSize() / 1024, Utils::PageModeName(TranspositionTable::getEvalCachePageMode()));
+        }
+    }
+    else if (strstr(params, "name Hash"))
+    {
+        if (Game::searching)
+            return;
+
+        // size in MB
+        TranspositionTable::setSize((uint64) value * 1024 * 1024);
+        if (TranspositionTable::isAllocated())
+        {
+            printf("info string hash table size %llu KB, using %s\n", TranspositionTable::getSize() / 1024, Utils::PageModeName(TranspositionTable::getPageMode()));
+        }
+    }
+}
+
+void UciInterface::InitTables()
+{
+    if (!TranspositionTable::isAllocated())
+    {
+        BitBoardUtils::init();
+        TranspositionTable::init();
+    }
+}
+
+// positions used by bench command
+// start position and the perft test positions from chess programming wiki
+static const char *benchPositions[] =
+{
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+};
+#define NUM_BENCH_POSITIONS (sizeof(benchPositions) / sizeof(benchPositions[0]))
+
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+void UciInterface::AttackBench(char *params)
+{
+    int iterations = DEFAULT_ATTACK_BENCH_ITERATIONS;
+    sscanf(params, "%d", &iterations);
+
+    if (Game::searching)
+        return;
+
+    InitTables();
+
+    // the bench positions along with all their children and grandchildren
+    const int maxPositions = NUM_BENCH_POSITIONS * MAX_MOVES * MAX_MOVES;
+    HexaBitBoardPosition *positions = (HexaBitBoardPosition *) malloc(maxPositions * sizeof(HexaBitBoardPosition));
+    HexaBitBoardPosition *children  = (HexaBitBoardPosition *) malloc(MAX_MOVES * sizeof(HexaBitBoardPosition));
+    HexaBitBoardPosition *grandChildren = (HexaBitBoardPosition *) malloc(MAX_MOVES * sizeof(HexaBitBoardPosition));
+    int nPositions = 0;
+
+    for (int i = 0; i < (int) NUM_BENCH_POSITIONS; i++)
+    {
+        char fen[256];
+        strcpy(fen, benchPositions[i]);
+
+        BoardPosition088 temp;
+        HexaBitBoardPosition pos;
+        Utils::readFENString(fen, &temp);
+        Utils::board088ToHexBB(&pos, &temp);
+        positions[nPositions++] = pos;
+
+        int nChildren = BitBoardUtils::GenerateBoards(&pos, children);
+        for (int j = 0; j < nChildren; j++)
+        {
+            positions[nPositions++] = children[j];
+            int nGrandChildren = BitBoardUtils::GenerateBoards(&children[j], grandChildren);
+            for (int k = 0; k < nGrandChildren; k++)
+            {
+                positions[nPositions++] = grandChildren[k];
+            }
+        }
+    }
+
+    BitBoardUtils::BenchmarkSimdAttacks(positions, nPositions, iterations);
+
+    free(grandChildren);
+    free(children);
+    free(positions);
+}
+#endif
+
+void UciInterface::SeeBench(char *params)
+{
+    int nGames = DEFAULT_SEE_BENCH_GAMES;
+    int iterations = DEFAULT_SEE_BENCH_ITERATIONS;
+    sscanf(params, "%d %d", &nGames, &iterations);
+
+    if (Game::searching)
+        return;
+
+    InitTables();
+
+    // all the positions reached in random games starting from the bench positions
+    // (fixed seed so that the same set of positions is used every time)
+    HexaBitBoardPosition *positions = (HexaBitBoardPosition *) malloc(nGames * SEE_BENCH_GAME_LENGTH * sizeof(HexaBitBoardPosition));
+    int nPositions = 0;
+    srand(1);
+
+    for (int i = 0; i < nGames; i++)
+    {
+        char fen[256];
+        strcpy(fen, benchPositions[i % NUM_BENCH_POSITIONS]);
+
+        BoardPosition088 temp;
+        HexaBitBoardPosition pos;
+        Utils::readFENString(fen, &temp);
+        Utils::board088ToHexBB(&pos, &temp);
+
+        for (int ply = 0; ply < SEE_BENCH_GAME_LENGTH; ply++)
+        {
+            CMove moves[MAX_MOVES];
+            int nMoves = BitBoardUtils::GenerateMoves(&pos, moves);
+            if (nMoves == 0)
+                break;
+
+            positions[nPositions++] = pos;
+
+            uint64 zero = 0;
+            BitBoardUtils::MakeMove(&pos, zero, moves[rand() % nMoves]);
+        }
+    }
+
+    BitBoardUtils::BenchmarkSEE(positions, nPositions, iterations);
+
+    free(positions);
+}
+
+void UciInterface::Bench(char *params)
+{
+    int depth = DEFAULT_BENCH_DEPTH;
+    int nThreads = 1;
+    sscanf(params, "%d %d", &depth, &nThreads);
+
+    if (Game::searching)
+        return;
+
+    // allow running bench without the "uci" command
+    InitTables();
+
+    // node count is deterministic only with a single thread
+    int oldThreads = Game::GetNumThreads();
+    Game::SetNumThreads(nThreads);
+
+    uint64 totalNodes = 0;
+    Timer timer;
+    timer.start();
+
+    for (int i = 0; i < (int) NUM_BENCH_POSITIONS; i++)
+    {
+        char fen[256];
+        strcpy(fen, benchPositions[i]);
+        printf("\nPosition %d/%d: %s\n", i + 1, (int) NUM_BENCH_POSITIONS, fen);
+
+        BoardPosition088 temp;
+        HexaBitBoardPosition pos;
+        Utils::readFENString(fen, &temp);
+        Utils::board088ToHexBB(&pos, &temp);
+
+        // every position is searched from a clean state
+        Game::Reset();
+        TranspositionTable::reset();
+        Game::SetPos(&pos);
+        Game::SetMaxDepth(depth + 1);
+        Game::SetTimeControls(0, 0, 0, 0, 0, INT_MAX);
+
+        Game::StartSearch();
+        totalNodes += Game::GetNodeCount();
+
+        printf("bestmove ");
+        Utils::displayCompactMove(Game::GetBestMove());
+        printf("\n");
+    }
+
+    uint64 time = timer.stop();
+    uint64 nps = time ? totalNodes * 1000 / time : 0;
+
+    printf("\n===========================\n");
+    printf("Total time (ms) : %llu\n", time);
+    printf("Nodes searched  : %llu\n", totalNodes);
+    printf("Nodes/second    : %llu\n", nps);
+
+    // total node count at a fixed depth changes only if the search or evaluation changes
+    if (nThreads == 1)
+        printf("Bench signature : %llu\n", totalNodes);
+    fflush(stdout);
+
+    Game::SetNumThreads(oldThreads);
+    Game::Reset();
+    TranspositionTable::reset();
+}
+
 void UciInterface::WorkerThreadMain()
 {
     Game::StartSearch();
@@ -102,8 +425,15 @@ void UciInterface::ProcessCommands()
     // the main game loop
     while (1) {
         input = buffer;
-        gets(input);
-        if (strstr(input, "ucinewgame")) 
+
+        // treat end of input as quit (e.g, when commands are piped in), otherwise the last command keeps repeating
+        if (gets(input) == NULL)
+            strcpy(input, "quit");
+        if (strstr(input, "setoption"))
+        {
+            SetOption(input);
+        }
+        else if (strstr(input, "ucinewgame")) 
         {
             // new game
             Game::Reset();
@@ -116,9 +446,44 @@ void UciInterface::ProcessCommands()
             // send back the IDs
             printf("id name Paladin 0.1\n");
             printf("id author Ankan Banerjee\n");
+            printf("option name Threads type spin default 1 min 1 max %d\n", MAX_SEARCH_THREADS);
+            printf("option name Hash type spin default %d min 2 max %d\n", (int) (DEAFULT_TT_SIZE / (1024 * 1024)), MAX_TT_SIZE_MB);
+            printf("option name QSearchHash type spin default %d min 2 max %d\n", (int) (DEFAULT_Q_TT_SIZE / (1024 * 1024)), MAX_TT_SIZE_MB);
+            printf("option name EvalCache type spin default %d min 1 max %d\n", (int) (DEFAULT_EVAL_CACHE_SIZE / (1024 * 1024)), MAX_TT_SIZE_MB);
+            printf("option name FutilityPruning type check default true\n");
+            printf("option name ReverseFutilityPruning type check default true\n");
+            printf("option name Razoring type check default true\n");
+#if USE_LATE_MOVE_REDUCTION == 1
+            printf("option name LateMoveReductions type check default true\n");
+#endif
+#if USE_LAZY_EVAL == 1
+            printf("option name LazyEval type check default true\n");
+            printf("option name LazyEvalMargin type spin default %d min 0 max 1000\n", DEFAULT_LAZY_EVAL_MARGIN);
+#endif
+#if USE_DELTA_PRUNING == 1
+            printf("option name DeltaPruning type check default true\n");
+            printf("option name DeltaPruningMargin type spin default %d min 0 max 1000\n", DEFAULT_DELTA_PRUNING_MARGIN);
+#endif
+            printf("option name PerftHash type spin default %d min 1 max %d\n", (int) (DEFAULT_PERFT_TT_SIZE / (1024 * 1024)), MAX_TT_SIZE_MB);
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+            printf("option name SlidingAttacks type combo default auto var auto var pext var fancy var plain\n");
+            printf("option name SimdAttacks type combo default auto var auto var off var avx2 var avx512\n");
+#endif
             fflush(stdout);
             BitBoardUtils::init();
-            TranspositionTable::init();
+
+            // hash size might have been already set (and the table allocated) by setoption
+            if (!TranspositionTable::isAllocated())
+                TranspositionTable::init();
+
+            printf("info string hash table using %s\n", Utils::PageModeName(TranspositionTable::getPageMode()));
+            printf("info string q-search hash table using %s\n", Utils::PageModeName(TranspositionTable::getQPageMode()));
+            printf("info string eval cache using %s\n", Utils::PageModeName(TranspositionTable::getEvalCachePageMode()));
+            printf("info string magic attack tables using %s\n", Utils::PageModeName(BitBoardUtils::GetMagicTablePageMode()));
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+            printf("info string sliding attacks using %s\n", BitBoardUtils::SlidingAttackModeName(BitBoardUtils::GetSlidingAttackMode()));
+            printf("info string simd attacks %s\n", BitBoardUtils::SimdAttackModeName(BitBoardUtils::GetSimdAttackMode()));
+#endif
 
             // send the "uciok" command
             printf("uciok\n");
@@ -216,9 +581,19 @@ void UciInterface::ProcessCommands()
             input += 3;
             Search_Go(input);
         }
+#if USE_RUNTIME_SLIDING_DISPATCH == 1
+        else if (strstr(input, "attackbench"))
+        {
+            AttackBench(strstr(input, "attackbench") + 11);
+        }
+#endif
+        else if (strstr(input, "seebench"))
+        {
+            SeeBench(strstr(input, "seebench") + 8);
+        }
         else if (strstr(input, "bench")) 
         {
-            printf("bench function TODO\n");
+            Bench(strstr(input, "bench") + 5);
         }
         else if (strstr(input, "eval"))
         {
@@ -227,14 +602,63 @@ void UciInterface::ProcessCommands()
             int val = BitBoardUtils::Evaluate(&pos);
             printf("\nBoard eval: %d\n", val);
         }
+        else if (strstr(input, "perftsuite"))
+        {
+            // perftsuite <file> [maxdepth] [threads]
+            char fileName[1024] = "";
+            int maxDepth = 6;
+            int nThreads = std::thread::hardware_concurrency();
+            sscanf(strstr(input, "perftsuite") + 10, "%1023s %d %d", fileName, &maxDepth, &nThreads);
+
+            InitTables();
+            Utils::testPerftFile(fileName, maxDepth, nThreads);
+        }
         else if (strstr(input, "perft"))
         {
-            input += 6;
-            int depth = atoi(input);
+            // perft <depth> [threads <n>] [split <ply>] [hash]
+            char *params = input + 6;
+            int depth = atoi(params);
+
+            int nThreads = 0;
+            char *str = strstr(params, "threads");
+            if (str)
+            {
+                sscanf(str + 8, "%d", &nThreads);
+            }
+
+            int splitPly = DEFAULT_PERFT_SPLIT_PLY;
+            str = strstr(params, "split");
+            if (str)
+            {
+                sscanf(str + 6, "%d", &splitPly);
+            }
+
+            // use perft TT
+            bool hashed = (strstr(params, "hash") != NULL);
 
             Timer timer;
             timer.start();
-            uint64 val = Game::Perft(depth);
+            uint64 val;
+            if (nThreads || hashed)
+            {
+                if (nThreads == 0)
+                    nThreads = 1;
+
+                uint64 threadNodes[MAX_SEARCH_THREADS];
+                int threadPositions[MAX_SEARCH_THREADS];
+                uint64 threadTime[MAX_SEARCH_THREADS];
+                val = Game::ParallelPerft(depth, nThreads, splitPly, hashed, threadNodes, threadPositions, threadTime);
+
+                for (int i = 0; i < nThreads && i < MAX_SEARCH_THREADS; i++)
+                {
+                    uint64 threadNps = threadTime[i] ? threadNodes[i] * 1000000 / threadTime[i] : 0;
+                    printf("thread %d: %llu nodes, %d positions, nps: %llu\n", i, threadNodes[i], threadPositions[i], threadNps);
+                }
+            }
+            else
+            {
+                val = Game::Perft(depth);
+            }
             uint64 time = timer.getElapsedMicroSeconds();
             uint64 nps = time ? val * 1000000 / time : 0;
             printf("perft %d: %llu, time: %llu us, nps: %llu\n", depth, val, time, nps);
@@ -251,7 +675,7 @@ void UciInterface::ProcessCommands()
             {
                 // crap... there is no way to forcefully terminate a C++11 thread :-/
                 // delete worker_thread;
-                Game::SetTimeControls(0, 0, 40, 0, 0, 1);
+                Game::StopSearch();
                 worker_thread = NULL;
             }
             // stop the current line of search, and display the best move found
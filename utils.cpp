@@ -1,5 +1,13 @@
 #include "chess.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 
 // Utilsity functions for reading FEN String, EPD file, displaying board, etc
 
@@ -676,35 +684,265 @@ int Utils::readMove(const char *input, const HexaBitBoardPosition *pos, CMove *m
 
 
 // reads a epd file with perft values and compares the values with the ones generated by the move generator
-/*
-void Utils::testPerftFile() {
-char buf[200][1000];
-unsigned long long realNodes[10];
-int n=0;
-FILE * fp = fopen("c:\\deltachess\\reference\\perftsuite.epd", "r");
-while(fgets(buf[n++], 995, fp));
-fclose(fp);
-
-for(maxDepth=1;maxDepth<7;maxDepth++) {
-for(int i=0;i<n-1;i++) {
-readFENString(buf[i]);
-readNodeCounts(buf[i], realNodes);
-
-dispBoard(board);
-printf("%d %d %d %d\n\n", chance, castleflagB, castleflagW, enPassentFlag);
-
-nodeCount=0;
-minMax(0);
-printf("\nNode Counts:  Actual - %llu, Real - %llu", nodeCount, realNodes[maxDepth]);
-if(nodeCount!=realNodes[maxDepth])
-printf("  #### FAILURE #####\n");
-else
-printf("  SUCCESS \n");
-printf("\n-------------------------------------------------------------------\n\n");
+// every line of the file is a FEN string followed by perft values e.g,
+// rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 ;D1 20 ;D2 400 ;D3 8902
+
+// max depth read from the epd file
+#define MAX_PERFT_SUITE_DEPTH 15
+
+// no. of positions read from the file (and processed in parallel) at a time
+#define PERFT_SUITE_BATCH_SIZE 1024
+
+struct PerftSuiteEntry
+{
+    HexaBitBoardPosition pos;
+    int    lineNo;
+    int    maxDepth;                                // deepest perft value available (limited by the maxDepth param)
+    uint64 expected[MAX_PERFT_SUITE_DEPTH + 1];
+    uint64 actual[MAX_PERFT_SUITE_DEPTH + 1];
+};
+
+static void perftSuiteThreadMain(PerftSuiteEntry *entries, int nEntries, std::atomic<int> *nextEntry)
+{
+    while (true)
+    {
+        int i = (*nextEntry)++;
+        if (i >= nEntries)
+            break;
+
+        for (int depth = 1; depth <= entries[i].maxDepth; depth++)
+        {
+            entries[i].actual[depth] = Game::Perft(&entries[i].pos, depth);
+        }
+    }
+}
+
+// parse a line of the epd file, returns false if there is no position in the line
+static bool readPerftSuiteLine(char *line, int maxDepth, PerftSuiteEntry *entry)
+{
+    memset(entry, 0, sizeof(PerftSuiteEntry));
+
+    char *counts = strchr(line, ';');
+    if (counts == NULL)
+        return false;
+
+    // ;D<depth> <count>
+    char *str = counts;
+    while ((str = strstr(str, ";D")) != NULL)
+    {
+        int depth = 0;
+        unsigned long long count = 0;
+        if (sscanf(str + 2, "%d %llu", &depth, &count) == 2 && depth >= 1 && depth <= maxDepth)
+        {
+            entry->expected[depth] = count;
+            if (depth > entry->maxDepth)
+                entry->maxDepth = depth;
+        }
+        str += 2;
+    }
+
+    // only the FEN part
+    *counts = 0;
+    BoardPosition088 temp;
+    Utils::readFENString(line, &temp);
+    Utils::board088ToHexBB(&entry->pos, &temp);
+    *counts = ';';
+
+    return entry->maxDepth > 0;
+}
+
+void Utils::testPerftFile(const char *fileName, int maxDepth, int nThreads)
+{
+    FILE *fp = fopen(fileName, "r");
+    if (!fp)
+    {
+        printf("can't open %s\n", fileName);
+        return;
+    }
+
+    if (maxDepth > MAX_PERFT_SUITE_DEPTH)
+        maxDepth = MAX_PERFT_SUITE_DEPTH;
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > MAX_SEARCH_THREADS)
+        nThreads = MAX_SEARCH_THREADS;
+
+    PerftSuiteEntry *entries = (PerftSuiteEntry *) malloc(sizeof(PerftSuiteEntry) * PERFT_SUITE_BATCH_SIZE);
+    if (!entries)
+    {
+        printf("can't allocate memory for %d positions of %s\n", PERFT_SUITE_BATCH_SIZE, fileName);
+        fclose(fp);
+        return;
+    }
+
+    char line[1024];
+    int lineNo = 0;
+
+    int nPositions = 0, nFailed = 0;
+    uint64 totalNodes = 0;
+
+    Timer timer;
+    timer.start();
+
+    bool endOfFile = false;
+    while (!endOfFile)
+    {
+        // read a batch of positions
+        int nEntries = 0;
+        while (nEntries < PERFT_SUITE_BATCH_SIZE)
+        {
+            if (!fgets(line, sizeof(line), fp))
+            {
+                endOfFile = true;
+                break;
+            }
+            lineNo++;
+
+            if (readPerftSuiteLine(line, maxDepth, &entries[nEntries]))
+            {
+                entries[nEntries].lineNo = lineNo;
+                nEntries++;
+            }
+        }
+
+        // and process them in parallel
+        std::atomic<int> nextEntry(0);
+        std::thread *threads[MAX_SEARCH_THREADS];
+        for (int i = 1; i < nThreads; i++)
+        {
+            threads[i] = new std::thread(perftSuiteThreadMain, entries, nEntries, &nextEntry);
+        }
+        perftSuiteThreadMain(entries, nEntries, &nextEntry);
+        for (int i = 1; i < nThreads; i++)
+        {
+            threads[i]->join();
+            delete threads[i];
+        }
+
+        for (int i = 0; i < nEntries; i++)
+        {
+            bool failed = false;
+            for (int depth = 1; depth <= entries[i].maxDepth; depth++)
+            {
+                totalNodes += entries[i].actual[depth];
+                if (entries[i].expected[depth] && entries[i].actual[depth] != entries[i].expected[depth])
+                {
+                    printf("line %d, depth %d: expected %llu, found %llu  #### FAILURE ####\n", entries[i].lineNo, depth,
+                           entries[i].expected[depth], entries[i].actual[depth]);
+                    failed = true;
+                }
+            }
+
+            if (failed)
+            {
+                nFailed++;
+                dispBoard(&entries[i].pos);
+            }
+        }
+        nPositions += nEntries;
+
+        printf("%d positions done, %d failed\n", nPositions, nFailed);
+        fflush(stdout);
+    }
+
+    fclose(fp);
+    free(entries);
+
+    uint64 time = timer.getElapsedMicroSeconds();
+    uint64 nps = time ? totalNodes * 1000000 / time : 0;
+    printf("\nperftsuite: %d positions, %d passed, %d failed\n", nPositions, nPositions - nFailed, nFailed);
+    printf("nodes: %llu, time: %llu us, nps: %llu\n", totalNodes, time, nps);
+    fflush(stdout);
 }
-printf("\n*********************END OF DEPTH %d **********************\n\n", maxDepth);
+
+
+// large page allocation (for TT and other big randomly accessed tables)
+// most accesses to these tables are TLB misses with regular 4 KB pages
+
+#define LARGE_PAGE_SIZE (2 * 1024 * 1024)
+
+void *Utils::LargePageAlloc(uint64 size, uint8 *pageMode)
+{
+    // round up to multiple of large page size
+    uint64 allocSize = (size + LARGE_PAGE_SIZE - 1) & ~((uint64) LARGE_PAGE_SIZE - 1);
+    void *mem = NULL;
+
+#ifdef _WIN32
+    // needs "Lock pages in memory" privilege, fails otherwise
+    SIZE_T largePageSize = GetLargePageMinimum();
+    if (largePageSize)
+    {
+        SIZE_T winAllocSize = (SIZE_T) ((size + largePageSize - 1) & ~((uint64) largePageSize - 1));
+        mem = VirtualAlloc(NULL, winAllocSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (mem)
+        {
+            *pageMode = PAGE_MODE_HUGETLB;
+            return mem;
+        }
+    }
+
+    mem = VirtualAlloc(NULL, (SIZE_T) size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    *pageMode = PAGE_MODE_REGULAR;
+    return mem;
+#else
+
+#ifdef MAP_HUGETLB
+    // explicit huge pages (only works if the admin has reserved some, e.g, using /proc/sys/vm/nr_hugepages)
+    mem = mmap(NULL, allocSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mem != MAP_FAILED)
+    {
+        *pageMode = PAGE_MODE_HUGETLB;
+        return mem;
+    }
+#endif
+
+    // fall back to transparent huge pages
+    // the memory needs to be aligned to large page boundary for the kernel to be able to use them
+    if (posix_memalign(&mem, LARGE_PAGE_SIZE, allocSize))
+    {
+        *pageMode = PAGE_MODE_REGULAR;
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(mem, allocSize, MADV_HUGEPAGE) == 0)
+    {
+        *pageMode = PAGE_MODE_THP;
+        return mem;
+    }
+#endif
+
+    *pageMode = PAGE_MODE_REGULAR;
+    return mem;
+#endif
 }
 
+void Utils::LargePageFree(void *mem, uint64 size, uint8 pageMode)
+{
+#ifdef _WIN32
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    if (pageMode == PAGE_MODE_HUGETLB)
+    {
+        uint64 allocSize = (size + LARGE_PAGE_SIZE - 1) & ~((uint64) LARGE_PAGE_SIZE - 1);
+        munmap(mem, allocSize);
+    }
+    else
+    {
+        free(mem);
+    }
+#endif
+}
 
+const char *Utils::PageModeName(uint8 pageMode)
+{
+    switch (pageMode)
+    {
+    case PAGE_MODE_HUGETLB:
+        return "large pages";
+    case PAGE_MODE_THP:
+        return "transparent huge pages (madvise)";
+    default:
+        return "regular pages";
+    }
 }
-*/
\ No newline at end of file